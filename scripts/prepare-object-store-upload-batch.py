@@ -14,6 +14,23 @@ remote = {}
 for name, hash in csv.reader(sys.stdin):
 	remote[name] = hash
 
+# mkpospages records the MD5 of every file it makes in ../manifest.txt, by path
+# relative to the GrappleMap dir. Most files here are symlinks into store/.
+
+recorded = {}
+root = os.path.realpath('..')
+
+if os.path.exists('../manifest.txt'):
+	for line in open('../manifest.txt').readlines()[1:]:
+		inputs, content, path = line.rstrip('\n').split(' ', 2)
+		recorded[path] = content
+
+def md5(f):
+	path = os.path.relpath(os.path.realpath(f), root)
+	if path in recorded:
+		return recorded[path]
+	return hashlib.md5(open(f, "rb").read()).hexdigest()
+
 good = 0
 bad = 0
 seen = 0
@@ -21,14 +38,14 @@ seen = 0
 dirlist = [x for x in os.listdir('.')
              if x.endswith(".gif") or x.endswith(".png")]
 
-perpercent = len(dirlist) / 100
+perpercent = max(1, len(dirlist) / 100)
 
 for f in dirlist:
 	if seen % perpercent == 0:
 		sys.stderr.write('\rComparing checksums: ' + str(seen / perpercent) + '%')
 	seen += 1
 
-	if f in remote and remote[f] == hashlib.md5(open(f, "rb").read()).hexdigest():
+	if f in remote and remote[f] == md5(f):
 		good += 1
 	else:
 		bad += 1
@@ -0,0 +1,249 @@
+#include "image.hpp"
+#include "png.hpp"
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <cstdio>
+
+#ifndef int_p_NULL // ffs
+	#define int_p_NULL (int*)NULL // https://github.com/ignf/gilviewer/issues/8
+#endif
+
+#include <boost/gil/extension/io/png_io.hpp>
+#include <boost/gil/gil_all.hpp>
+
+using namespace GrappleMap;
+
+namespace
+{
+	struct Config
+	{
+		unsigned width, height, reps;
+	};
+
+	optional<Config> config_from_args(int const argc, char const * const * const argv)
+	{
+		namespace po = boost::program_options;
+
+		po::options_description desc("options");
+		desc.add_options()
+			("help,h", "show this help")
+			("width", po::value<unsigned>()->default_value(1280), "output width")
+			("height", po::value<unsigned>()->default_value(720), "output height")
+			("reps", po::value<unsigned>()->default_value(50), "repetitions per measurement");
+
+		po::variables_map vm;
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+
+		if (vm.count("help"))
+		{
+			std::cout << "Usage: grapplemap-bench [options]\n\n" << desc << '\n';
+			return none;
+		}
+
+		return Config
+			{ vm["width"].as<unsigned>()
+			, vm["height"].as<unsigned>()
+			, std::max(1u, vm["reps"].as<unsigned>()) };
+	}
+
+	Image reference_downsample(vector<RGB> const & buf, unsigned const width, unsigned const height, unsigned const f)
+		// how ImageMaker used to do it, on a packed RGB framebuffer
+	{
+		Image r(width, height);
+
+		auto xy = [&](unsigned x, unsigned y) -> RGB { return buf[y*width*f+x]; };
+
+		for (unsigned x = 0; x != width; ++x)
+		for (unsigned y = 0; y != height; ++y)
+		{
+			unsigned cr = 0, cg = 0, cb = 0;
+
+			for (unsigned dy = 0; dy != f; ++dy)
+			for (unsigned dx = 0; dx != f; ++dx)
+			{
+				RGB const p = xy(x*f+dx, y*f+dy);
+				cr += p.r; cg += p.g; cb += p.b;
+			}
+
+			r(x, height - 1 - y) = RGB{uint8_t(cb / (f*f)), uint8_t(cg / (f*f)), uint8_t(cr / (f*f))};
+		}
+
+		return r;
+	}
+
+	template<typename F>
+	double milliseconds(unsigned const reps, F f)
+	{
+		auto const start = std::chrono::steady_clock::now();
+		for (unsigned i = 0; i != reps; ++i) f();
+		std::chrono::duration<double, std::milli> const d = std::chrono::steady_clock::now() - start;
+		return d.count() / reps;
+	}
+
+	void report(string const & what, double const ms, double const baseline, string const & extra = "")
+	{
+		std::cout
+			<< std::left << std::setw(32) << what
+			<< std::right << std::fixed << std::setprecision(3) << std::setw(10) << ms << " ms"
+			<< std::setprecision(1) << std::setw(8) << baseline / ms << "x"
+			<< extra << '\n';
+	}
+
+	void bench_downsample(Config const & c, unsigned const f)
+	{
+		size_t const n = size_t(c.width) * f * c.height * f;
+
+		vector<RGBA> rgba(n);
+		vector<RGB> rgb(n);
+
+		std::srand(f);
+		for (size_t i = 0; i != n; ++i)
+		{
+			uint8_t const r = std::rand(), g = std::rand(), b = std::rand();
+			rgba[i] = RGBA{r, g, b, 255};
+			rgb[i] = RGB{r, g, b};
+		}
+
+		if (reference_downsample(rgb, c.width, c.height, f).pixels
+				!= downsample(rgba.data(), c.width, c.height, f).pixels)
+			error("downsample differs from reference at factor " + to_string(f));
+
+		Image sink;
+
+		double const
+			old = milliseconds(c.reps, [&]{ sink = reference_downsample(rgb, c.width, c.height, f); }),
+			now = milliseconds(c.reps, [&]{ sink = downsample(rgba.data(), c.width, c.height, f); });
+
+		string const name = "downsample " + to_string(f) + "x";
+
+		report(name + " (old loop)", old, old);
+		report(name, now, old);
+	}
+
+	void bench_motion_blur(Config const & c, unsigned const frames)
+		// the CPU side of a blurred frame: summing the supersampled renders, then scaling down
+	{
+		size_t const n = size_t(c.width) * 2 * c.height * 2;
+
+		vector<vector<RGBA>> renders(frames, vector<RGBA>(n));
+
+		std::srand(frames);
+		foreach (r : renders)
+		foreach (p : r)
+			p = RGBA{uint8_t(std::rand()), uint8_t(std::rand()), uint8_t(std::rand()), 255};
+
+		Accumulator a;
+		a.add(renders[0].data(), n);
+		if (downsample(a.average(), c.width, c.height, 2).pixels
+				!= downsample(renders[0].data(), c.width, c.height, 2).pixels)
+			error("averaging a single frame changed it");
+
+		Image sink;
+
+		double const
+			one = milliseconds(c.reps, [&]{ sink = downsample(renders[0].data(), c.width, c.height, 2); }),
+			blurred = milliseconds(c.reps, [&]
+				{
+					a.reset();
+					foreach (r : renders) a.add(r.data(), n);
+					sink = downsample(a.average(), c.width, c.height, 2);
+				});
+
+		report("downsample 2x (one render)", one, one);
+		report("motion blur " + to_string(frames) + " renders 2x", blurred, one);
+	}
+
+	Image test_image(unsigned const w, unsigned const h)
+		// something like a render: flat background, grid lines, and shaded blobs
+	{
+		Image r(w, h);
+
+		for (unsigned y = 0; y != h; ++y)
+		for (unsigned x = 0; x != w; ++x)
+		{
+			RGB & p = r(x, y);
+			p = (x % 64 < 2 || y % 64 < 2) ? RGB{204, 204, 204} : RGB{255, 255, 255};
+
+			for (int i = 0; i != 2; ++i)
+			{
+				double const
+					cx = w * (.35 + .3 * i), cy = h * .5,
+					d = std::hypot(x - cx, y - cy) / (h * .3);
+
+				if (d < 1)
+				{
+					uint8_t const shade = 80 + 150 * (1 - d);
+					p = i ? RGB{shade, uint8_t(shade / 4), uint8_t(shade / 4)} : RGB{uint8_t(shade / 4), uint8_t(shade / 4), shade};
+				}
+			}
+		}
+
+		return r;
+	}
+
+	void bench_png(Config const & c)
+	{
+		Image const image = test_image(c.width, c.height);
+		string const path = "grapplemap-bench.png";
+		double const megabytes = image.pixels.size() * sizeof(RGB) / 1e6;
+
+		auto size = [&]{ std::ifstream f(path, std::ios::binary | std::ios::ate); return size_t(f.tellg()); };
+
+		auto line = [&](string const & what, double const ms, double const baseline)
+			{
+				std::ostringstream extra;
+				extra << std::fixed << std::setw(8) << std::setprecision(0) << megabytes / ms * 1000 << " MB/s"
+					<< std::setw(9) << size() / 1024 << " KiB";
+				report(what, ms, baseline, extra.str());
+			};
+
+		double const gil = milliseconds(c.reps, [&]
+			{
+				boost::gil::png_write_view(path,
+					boost::gil::interleaved_view(image.width, image.height,
+						reinterpret_cast<boost::gil::rgb8_pixel_t const *>(image.pixels.data()),
+						image.width * 3));
+			});
+
+		line("png (boost::gil)", gil, gil);
+
+		pair<string, PngOptions> const presets[] =
+			{ {"png fast", PngOptions::fast()}
+			, {"png normal", PngOptions::normal()}
+			, {"png small", PngOptions::small()} };
+
+		foreach (p : presets)
+			line(p.first, milliseconds(c.reps, [&]{ write_png(image, path, p.second); }), gil);
+
+		std::remove(path.c_str());
+	}
+}
+
+int main(int const argc, char const * const * const argv)
+{
+	try
+	{
+		optional<Config> const config = config_from_args(argc, argv);
+		if (!config) return 0;
+
+		std::cout << config->width << 'x' << config->height << " output, "
+			<< config->reps << " repetitions\n";
+
+		bench_downsample(*config, 2);
+		bench_downsample(*config, 4);
+		bench_motion_blur(*config, 4);
+		bench_png(*config);
+	}
+	catch (exception const & e)
+	{
+		std::cerr << "error: " << e.what() << '\n';
+		return 1;
+	}
+}
@@ -0,0 +1,239 @@
+#include "images.hpp"
+#include "png.hpp"
+#include "persistence.hpp"
+#include <boost/program_options.hpp>
+#include <sys/resource.h>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+using namespace GrappleMap;
+
+namespace
+{
+	struct Config
+	{
+		string db;
+		unsigned positions;
+		uint32_t seed;
+		vector<pair<unsigned, unsigned>> resolutions;
+		vector<unsigned> supersampling;
+		vector<ImageView> views;
+	};
+
+	template<typename T, typename F>
+	vector<T> split(string const & s, F parse)
+	{
+		vector<T> r;
+		std::istringstream in(s);
+		string item;
+		while (std::getline(in, item, ','))
+			if (!item.empty()) r.push_back(parse(item));
+		return r;
+	}
+
+	pair<unsigned, unsigned> resolution(string const & s)
+	{
+		auto const x = s.find('x');
+		if (x == s.npos) throw runtime_error("invalid resolution: " + s);
+		return {std::stoul(s.substr(0, x)), std::stoul(s.substr(x + 1))};
+	}
+
+	ImageView view(char const c)
+	{
+		foreach (v : views())
+			if (code(v) == c) return v;
+
+		throw runtime_error(string("invalid view: ") + c);
+	}
+
+	optional<Config> config_from_args(int const argc, char const * const * const argv)
+	{
+		namespace po = boost::program_options;
+
+		po::options_description desc("options");
+		desc.add_options()
+			("help,h", "show this help")
+			("db", po::value<string>()->default_value("GrappleMap.txt"), "database file")
+			("positions", po::value<unsigned>()->default_value(10), "number of positions rendered per setting")
+			("seed", po::value<uint32_t>()->default_value(1), "PRNG seed for picking the positions")
+			("resolutions", po::value<string>()->default_value("320x240,1280x720"), "comma-separated")
+			("supersampling", po::value<string>()->default_value("1,2,4"), "comma-separated factors")
+			("views", po::value<string>()->default_value("nE"),
+				"heading codes as in image names (n, e, s, w; upper case for mirrored)");
+
+		po::variables_map vm;
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+
+		if (vm.count("help"))
+		{
+			std::cerr << "Usage: grapplemap-benchrender [options]\n\n"
+				"Renders a fixed set of positions and writes timings as JSON to stdout.\n\n" << desc << '\n';
+			return none;
+		}
+
+		Config c
+			{ vm["db"].as<string>()
+			, std::max(1u, vm["positions"].as<unsigned>())
+			, vm["seed"].as<uint32_t>()
+			, split<pair<unsigned, unsigned>>(vm["resolutions"].as<string>(), resolution)
+			, split<unsigned>(vm["supersampling"].as<string>(), [](string const & s){ return unsigned(std::stoul(s)); })
+			, {} };
+
+		foreach (ch : vm["views"].as<string>()) c.views.push_back(view(ch));
+
+		if (c.resolutions.empty() || c.supersampling.empty() || c.views.empty())
+			throw runtime_error("nothing to render");
+
+		return c;
+	}
+
+	vector<Position> pick_positions(Graph const & graph, unsigned const n, uint32_t const seed)
+		// with mt19937, because std::rand sequences differ between libraries
+	{
+		std::mt19937 rng(seed);
+		vector<Position> r;
+
+		while (r.size() != n)
+		{
+			auto const & positions = graph[SeqNum{uint16_t(rng() % graph.num_sequences())}].positions;
+			r.push_back(positions[rng() % positions.size()]);
+		}
+
+		return r;
+	}
+
+	double ymax(Position const & p)
+	{
+		return std::max(.8, std::max(p[0][Head].y, p[1][Head].y));
+	}
+
+	long peak_rss_kib()
+	{
+		rusage u;
+		getrusage(RUSAGE_SELF, &u);
+		return u.ru_maxrss; // kilobytes on Linux
+	}
+
+	struct Run
+	{
+		unsigned width, height, supersampling;
+		char view;
+		size_t frames;
+		double seconds, encode, png_bytes;
+		RenderTimes times;
+	};
+
+	Run run(Graph const & graph, vector<Position> const & positions,
+		unsigned const width, unsigned const height, unsigned const ss, ImageView const view)
+	{
+		ImageMaker mkimg(graph, ss);
+		V3 const bg = ImageMaker::color(ImageMaker::WhiteBg);
+
+		mkimg.image(positions.front(), ymax(positions.front()), view, width, height, bg);
+			// warm up: context creation, display lists, and the like
+
+		Run r{width, height, ss, code(view), positions.size(), 0, 0, 0, {}};
+
+		mkimg.record_times(&r.times);
+
+		auto const start = std::chrono::steady_clock::now();
+
+		foreach (p : positions)
+		{
+			Image const image = mkimg.image(p, ymax(p), view, width, height, bg);
+
+			auto const encoding = std::chrono::steady_clock::now();
+			r.png_bytes += encode_png(image, PngOptions::small()).size();
+			r.encode += std::chrono::duration<double>(std::chrono::steady_clock::now() - encoding).count();
+		}
+
+		r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		return r;
+	}
+
+	string json_string(string const & s)
+	{
+		string r = "\"";
+		foreach (c : s)
+		{
+			if (c == '"' || c == '\\') r += '\\';
+			if (unsigned(c) < 0x20) { r += ' '; continue; }
+			r += c;
+		}
+		return r + '"';
+	}
+
+	void write_json(ostream & o, Config const & c, vector<Run> const & runs, double const load_seconds)
+	{
+		auto ms = [](double const total, size_t const n) { return total / n * 1000; };
+
+		o << std::fixed << std::setprecision(3)
+		  << "{\n"
+		  << "  \"db\": " << json_string(c.db) << ",\n"
+		  << "  \"seed\": " << c.seed << ",\n"
+		  << "  \"positions\": " << c.positions << ",\n"
+		  << "  \"load_ms\": " << load_seconds * 1000 << ",\n"
+		  << "  \"runs\": [\n";
+
+		for (size_t i = 0; i != runs.size(); ++i)
+		{
+			Run const & r = runs[i];
+
+			o << "    {\"width\": " << r.width
+			  << ", \"height\": " << r.height
+			  << ", \"supersampling\": " << r.supersampling
+			  << ", \"view\": \"" << r.view << '"'
+			  << ", \"frames\": " << r.frames
+			  << ", \"fps\": " << r.frames / r.seconds
+			  << ", \"ms_per_frame\": {"
+			  << "\"render\": " << ms(r.times.render, r.frames)
+			  << ", \"readback\": " << ms(r.times.readback, r.frames)
+			  << ", \"downsample\": " << ms(r.times.downsample, r.frames)
+			  << ", \"encode\": " << ms(r.encode, r.frames)
+			  << ", \"total\": " << ms(r.seconds, r.frames) << '}'
+			  << ", \"png_bytes_per_frame\": " << std::setprecision(0) << r.png_bytes / r.frames << std::setprecision(3)
+			  << '}' << (i + 1 == runs.size() ? "" : ",") << '\n';
+		}
+
+		o << "  ],\n"
+		  << "  \"peak_rss_kib\": " << peak_rss_kib() << '\n'
+		  << "}\n";
+	}
+}
+
+int main(int const argc, char const * const * const argv)
+{
+	try
+	{
+		optional<Config> const config = config_from_args(argc, argv);
+		if (!config) return 0;
+
+		auto const start = std::chrono::steady_clock::now();
+		Graph const graph = loadGraph(config->db);
+		double const load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		vector<Position> const positions = pick_positions(graph, config->positions, config->seed);
+
+		vector<Run> runs;
+
+		foreach (res : config->resolutions)
+		foreach (ss : config->supersampling)
+		foreach (v : config->views)
+		{
+			std::cerr << res.first << 'x' << res.second << " x" << ss << ' ' << code(v) << "...\n";
+			runs.push_back(run(graph, positions, res.first, res.second, ss, v));
+		}
+
+		write_json(std::cout, *config, runs, load_seconds);
+	}
+	catch (exception const & e)
+	{
+		std::cerr << "error: " << e.what() << '\n';
+		return 1;
+	}
+}
@@ -0,0 +1,362 @@
+#include "persistence.hpp"
+#include <cstring>
+#include <sstream>
+#include <type_traits>
+
+#ifdef _WIN32
+	#include <iterator>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace GrappleMap {
+
+namespace
+{
+	/* Layout (native byte order, all sections 8-byte aligned):
+
+		Header
+		PositionRecord[position_count]   (node positions first, then sequence positions)
+		NodeRecord[node_count]
+		EdgeRecord[edge_count]
+		LineRecord[line_count]
+		char[string_bytes]               (description lines, not null-terminated)
+
+	   Coordinates are stored with the same millimeter precision as the text format,
+	   so converting text to binary and back is lossless. */
+
+	char const magic[8] = {'G', 'R', 'A', 'P', 'P', 'L', 'E', 'B'};
+	uint32_t const version = 1;
+	uint32_t const byte_order_mark = 0x01020304;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version, byte_order_mark;
+		uint32_t position_count, node_count, edge_count, line_count;
+		uint64_t string_bytes;
+	};
+
+	using PositionRecord = array<uint16_t, joint_count * 2 * 3>;
+
+	struct NodeRecord
+	{
+		uint32_t first_line, line_count;
+	};
+
+	struct LinkRecord
+	{
+		double offset[3], angle;
+		uint16_t node;
+		uint8_t swap_players, mirror;
+		uint32_t padding;
+	};
+
+	struct EdgeRecord
+	{
+		uint32_t first_position, position_count;
+		uint32_t first_line, line_count;
+		uint32_t line_nr; // 0 means none
+		uint32_t padding;
+		LinkRecord from, to;
+	};
+
+	struct LineRecord
+	{
+		uint32_t offset, length;
+	};
+
+	static_assert(std::is_trivially_copyable<Header>::value, "");
+	static_assert(sizeof(Header) % 8 == 0, "");
+	static_assert(sizeof(EdgeRecord) % 8 == 0, "");
+
+	size_t aligned(size_t const n) { return (n + 7) & ~size_t(7); }
+
+	class MappedFile
+	{
+		char const * data_ = nullptr;
+		size_t size_ = 0;
+
+		#ifdef _WIN32
+			vector<char> buf;
+		#endif
+
+	public:
+
+		explicit MappedFile(string const & filename)
+		{
+			#ifdef _WIN32
+				std::ifstream f(filename, std::ios::binary);
+				if (!f) error(filename + ": " + std::strerror(errno));
+				buf.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+				data_ = buf.data();
+				size_ = buf.size();
+			#else
+				int const fd = open(filename.c_str(), O_RDONLY);
+				if (fd == -1) error(filename + ": " + std::strerror(errno));
+
+				struct stat st;
+				if (fstat(fd, &st) != 0) { close(fd); error(filename + ": " + std::strerror(errno)); }
+				size_ = st.st_size;
+
+				if (size_ != 0)
+				{
+					void * const p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+					if (p == MAP_FAILED) { close(fd); error(filename + ": mmap: " + std::strerror(errno)); }
+					data_ = static_cast<char const *>(p);
+				}
+
+				close(fd);
+			#endif
+		}
+
+		~MappedFile()
+		{
+			#ifndef _WIN32
+				if (data_) munmap(const_cast<char *>(data_), size_);
+			#endif
+		}
+
+		MappedFile(MappedFile const &) = delete;
+		MappedFile & operator=(MappedFile const &) = delete;
+
+		char const * data() const { return data_; }
+		size_t size() const { return size_; }
+	};
+
+	template<typename T>
+	T const * section(MappedFile const & f, size_t & offset, size_t const count)
+	{
+		T const * const r = reinterpret_cast<T const *>(f.data() + offset);
+		offset += aligned(count * sizeof(T));
+		if (offset > f.size()) error("truncated binary database");
+		return r;
+	}
+
+	PositionRecord encode(Position const & p, string const & what)
+	{
+		PositionRecord r;
+		auto o = r.begin();
+
+		foreach (j : playerJoints)
+		{
+			auto quantize = [&](double const d)
+				{
+					int const i = int(std::round(d * 1000));
+
+					if (i < 0 || i >= 4000)
+					{
+						std::ostringstream m;
+						m << what << ": " << j << " at " << p[j] << " is outside the storable range";
+						throw runtime_error(m.str());
+					}
+
+					return uint16_t(i);
+				};
+
+			*o++ = quantize(p[j].x + 2);
+			*o++ = quantize(p[j].y);
+			*o++ = quantize(p[j].z + 2);
+		}
+
+		return r;
+	}
+
+	Position decode(PositionRecord const & r)
+	{
+		Position p;
+		auto i = r.begin();
+
+		foreach (j : playerJoints)
+		{
+			p[j].x = double(i[0]) / 1000 - 2;
+			p[j].y = double(i[1]) / 1000;
+			p[j].z = double(i[2]) / 1000 - 2;
+			i += 3;
+		}
+
+		return p;
+	}
+
+	LinkRecord link(ReorientedNode const & n)
+	{
+		auto const & r = n.reorientation;
+
+		LinkRecord l;
+		std::memset(&l, 0, sizeof l);
+		l.offset[0] = r.reorientation.offset.x;
+		l.offset[1] = r.reorientation.offset.y;
+		l.offset[2] = r.reorientation.offset.z;
+		l.angle = r.reorientation.angle;
+		l.node = n.node.index;
+		l.swap_players = r.swap_players;
+		l.mirror = r.mirror;
+		return l;
+	}
+
+	ReorientedNode unlink(LinkRecord const & l)
+	{
+		return ReorientedNode
+			{ NodeNum{l.node}
+			, PositionReorientation
+				{ Reorientation{V3{l.offset[0], l.offset[1], l.offset[2]}, l.angle}
+				, l.swap_players != 0
+				, l.mirror != 0 } };
+	}
+
+	template<typename T>
+	void write_section(std::ostream & o, vector<T> const & v)
+	{
+		size_t const n = v.size() * sizeof(T);
+		o.write(reinterpret_cast<char const *>(v.data()), n);
+		for (size_t i = n; i != aligned(n); ++i) o.put(0);
+	}
+}
+
+bool is_binary_db(string const filename)
+{
+	std::ifstream f(filename, std::ios::binary);
+	char m[sizeof magic];
+	return f.read(m, sizeof m) && std::memcmp(m, magic, sizeof m) == 0;
+}
+
+Graph loadBinaryGraph(string const filename)
+{
+	MappedFile const f(filename);
+
+	if (f.size() < sizeof(Header)) error(filename + ": truncated binary database");
+
+	Header h;
+	std::memcpy(&h, f.data(), sizeof h);
+
+	if (std::memcmp(h.magic, magic, sizeof magic) != 0) error(filename + ": not a binary database");
+	if (h.byte_order_mark != byte_order_mark) error(filename + ": binary database has foreign byte order");
+	if (h.version != version) error(filename + ": unsupported binary database version " + to_string(h.version));
+
+	size_t offset = sizeof h;
+
+	auto const positions = section<PositionRecord>(f, offset, h.position_count);
+	auto const node_records = section<NodeRecord>(f, offset, h.node_count);
+	auto const edge_records = section<EdgeRecord>(f, offset, h.edge_count);
+	auto const lines = section<LineRecord>(f, offset, h.line_count);
+	auto const strings = section<char>(f, offset, h.string_bytes);
+
+	if (h.position_count < h.node_count) error(filename + ": corrupt binary database");
+
+	auto description = [&](uint32_t const first, uint32_t const count)
+		{
+			if (uint64_t(first) + count > h.line_count) error(filename + ": corrupt binary database");
+
+			vector<string> v;
+			v.reserve(count);
+
+			for (auto l = lines + first; l != lines + first + count; ++l)
+			{
+				if (uint64_t(l->offset) + l->length > h.string_bytes) error(filename + ": corrupt binary database");
+				v.emplace_back(strings + l->offset, l->length);
+			}
+
+			return v;
+		};
+
+	vector<Graph::Node> nodes;
+	nodes.reserve(h.node_count);
+
+	for (uint32_t i = 0; i != h.node_count; ++i)
+		nodes.push_back(Graph::Node{
+			decode(positions[i]),
+			description(node_records[i].first_line, node_records[i].line_count)});
+
+	vector<Graph::Edge> edges;
+	edges.reserve(h.edge_count);
+
+	for (auto e = edge_records; e != edge_records + h.edge_count; ++e)
+	{
+		if (e->position_count < 2 || uint64_t(e->first_position) + e->position_count > h.position_count)
+			error(filename + ": corrupt binary database");
+
+		Sequence seq{description(e->first_line, e->line_count), {}, none};
+		if (e->line_nr != 0) seq.line_nr = e->line_nr;
+
+		seq.positions.reserve(e->position_count);
+		for (auto p = positions + e->first_position; p != positions + e->first_position + e->position_count; ++p)
+			seq.positions.push_back(decode(*p));
+
+		edges.push_back(Graph::Edge{unlink(e->from), unlink(e->to), move(seq)});
+	}
+
+	return Graph(move(nodes), move(edges));
+}
+
+void saveBinary(Graph const & g, string const filename)
+{
+	vector<PositionRecord> positions;
+	vector<NodeRecord> node_records;
+	vector<EdgeRecord> edge_records;
+	vector<LineRecord> lines;
+	string strings;
+
+	auto add_lines = [&](vector<string> const & desc)
+		{
+			uint32_t const first = lines.size();
+			foreach (l : desc)
+			{
+				lines.push_back(LineRecord{uint32_t(strings.size()), uint32_t(l.size())});
+				strings += l;
+			}
+			return first;
+		};
+
+	foreach (n : nodenums(g))
+	{
+		positions.push_back(encode(g[n].position, "node " + to_string(n.index)));
+		node_records.push_back(NodeRecord{add_lines(g[n].description), uint32_t(g[n].description.size())});
+	}
+
+	foreach (s : seqnums(g))
+	{
+		Sequence const & seq = g[s];
+
+		EdgeRecord e;
+		std::memset(&e, 0, sizeof e);
+		e.first_position = positions.size();
+		e.position_count = seq.positions.size();
+		e.line_count = seq.description.size();
+		e.first_line = add_lines(seq.description);
+		e.line_nr = seq.line_nr ? *seq.line_nr : 0;
+		e.from = link(g.from(s));
+		e.to = link(g.to(s));
+		edge_records.push_back(e);
+
+		foreach (p : seq.positions)
+			positions.push_back(encode(p, "sequence " + to_string(s.index) + " (\"" + seq.description.front() + "\")"));
+	}
+
+	Header h;
+	std::memset(&h, 0, sizeof h);
+	std::memcpy(h.magic, magic, sizeof magic);
+	h.version = version;
+	h.byte_order_mark = byte_order_mark;
+	h.position_count = positions.size();
+	h.node_count = node_records.size();
+	h.edge_count = edge_records.size();
+	h.line_count = lines.size();
+	h.string_bytes = strings.size();
+
+	std::ofstream f(filename, std::ios::binary);
+	if (!f) error(filename + ": " + std::strerror(errno));
+
+	f.write(reinterpret_cast<char const *>(&h), sizeof h);
+	write_section(f, positions);
+	write_section(f, node_records);
+	write_section(f, edge_records);
+	write_section(f, lines);
+	write_section(f, vector<char>(strings.begin(), strings.end()));
+
+	if (!f) error(filename + ": write failed");
+}
+
+}
@@ -70,6 +70,7 @@ public:
 	}
 
 	double getHorizontalRotation() const { return orientation.x; }
+	V3 getOffset() const { return offset; }
 
 	V2 getViewportSize() const { return viewportSize; }
 };
@@ -0,0 +1,150 @@
+#include "persistence.hpp"
+#include <boost/program_options.hpp>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+using namespace GrappleMap;
+
+struct Config
+{
+	string input, output;
+	bool binary;
+	bool check;
+};
+
+optional<Config> config_from_args(int const argc, char const * const * const argv)
+{
+	namespace po = boost::program_options;
+
+	po::options_description desc("options");
+	desc.add_options()
+		("help,h",
+			"show this help")
+		("db",
+			po::value<string>()->default_value("GrappleMap.txt"),
+			"input database file (text or binary)")
+		("output",
+			po::value<string>(),
+			"output database file")
+		("format",
+			po::value<string>(),
+			"output format: text or binary (default: the opposite of the input format)")
+		("check",
+			"instead of converting, check that saving the database in either format and loading it back loses nothing");
+
+	po::positional_options_description posopts;
+	posopts.add("output", 1);
+
+	po::variables_map vm;
+	po::store(po::command_line_parser(argc, argv).options(desc).positional(posopts).run(), vm);
+	po::notify(vm);
+
+	if (vm.count("help") || (!vm.count("output") && !vm.count("check")))
+	{
+		std::cout << "Usage: grapplemap-convertdb [OPTIONS] OUTPUT\n"
+			"       grapplemap-convertdb --check [--db FILE]\n\n" << desc << '\n';
+		return none;
+	}
+
+	string const input = vm["db"].as<string>();
+
+	bool binary = !is_binary_db(input);
+
+	if (auto const format = optionalopt<string>(vm, "format"))
+	{
+		if (*format == "binary") binary = true;
+		else if (*format == "text") binary = false;
+		else throw runtime_error("unknown format: " + *format);
+	}
+
+	return Config{input, vm.count("output") ? vm["output"].as<string>() : string(), binary, bool(vm.count("check"))};
+}
+
+bool same(Position const & a, Position const & b)
+{
+	foreach (j : playerJoints)
+		if (a[j].x != b[j].x || a[j].y != b[j].y || a[j].z != b[j].z)
+			return false;
+
+	return true;
+}
+
+string contents(string const & filename)
+{
+	std::ifstream f(filename, std::ios::binary);
+	if (!f) error(filename + ": could not open");
+	return string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+bool check(string const & db)
+	// Saving a loaded text database must reproduce it byte for byte, and a binary
+	// save must load back to the same nodes, sequences, and exact coordinates.
+{
+	Graph const g = loadGraph(db);
+	string const tmp = db + ".check.tmp";
+	bool ok = true;
+
+	auto fail = [&](string const & what) { std::cerr << "check failed: " << what << '\n'; ok = false; };
+
+	if (!is_binary_db(db))
+	{
+		save(g, tmp);
+		if (contents(tmp) != contents(db)) fail("saving the loaded text database does not reproduce it");
+	}
+
+	saveBinary(g, tmp);
+	Graph const b = loadBinaryGraph(tmp);
+	std::remove(tmp.c_str());
+
+	if (b.num_nodes() != g.num_nodes() || b.num_sequences() != g.num_sequences())
+	{
+		fail("the binary database has different numbers of nodes or sequences");
+		return false;
+	}
+
+	foreach (n : nodenums(g))
+		if (!same(b[n].position, g[n].position) || b[n].description != g[n].description)
+			fail("node " + to_string(n.index) + " differs in the binary database");
+
+	foreach (s : seqnums(g))
+	{
+		Sequence const & x = g[s], & y = b[s];
+
+		bool positions_same = x.positions.size() == y.positions.size();
+		for (size_t i = 0; positions_same && i != x.positions.size(); ++i)
+			positions_same = same(x.positions[i], y.positions[i]);
+
+		if (!positions_same || x.description != y.description
+				|| g.from(s).node != b.from(s).node || g.to(s).node != b.to(s).node)
+			fail("sequence " + to_string(s.index) + " differs in the binary database");
+	}
+
+	return ok;
+}
+
+int main(int const argc, char const * const * const argv)
+{
+	try
+	{
+		optional<Config> const config = config_from_args(argc, argv);
+		if (!config) return 0;
+
+		if (config->check)
+		{
+			if (!check(config->input)) return 1;
+			std::cout << config->input << ": text and binary round trips are exact\n";
+			return 0;
+		}
+
+		Graph const g = loadGraph(config->input);
+
+		if (config->binary) saveBinary(g, config->output);
+		else save(g, config->output);
+	}
+	catch (std::exception const & e)
+	{
+		std::cerr << "error: " << e.what() << '\n';
+		return 1;
+	}
+}
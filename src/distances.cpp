@@ -0,0 +1,170 @@
+#include "distances.hpp"
+#include "persistence.hpp"
+#include "parallel.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace GrappleMap {
+
+namespace
+{
+	/* File layout (native byte order):
+
+		Header
+		uint16_t hops[node_count * node_count]
+		uint32_t first_steps[node_count * node_count] */
+
+	char const magic[8] = {'G', 'R', 'A', 'P', 'P', 'L', 'E', 'D'};
+	uint32_t const version = 2;
+	uint32_t const byte_order_mark = 0x01020304;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version, byte_order_mark;
+		char topology[32];
+		uint32_t node_count, padding;
+	};
+}
+
+uint16_t const Distances::none;
+uint32_t const Distances::no_step;
+
+string Distances::topology_of(Graph const & g)
+{
+	std::ostringstream o;
+	o << g.num_nodes() << '\n';
+
+	foreach (s : seqnums(g))
+		o << g.from(s).node.index << ' ' << g.to(s).node.index << ' ' << is_bidirectional(g, s) << '\n';
+
+	return md5(o.str());
+}
+
+Distances::Distances(Graph const & g)
+	: n(g.num_nodes())
+	, topology(topology_of(g))
+{
+	if (n >= none) error("too many nodes for a distance table");
+	if (g.num_sequences() >= no_step / 2) error("too many sequences for a distance table");
+
+	hops.assign(size_t(n) * n, none);
+	first_steps.assign(size_t(n) * n, no_step);
+
+	parallel_for(n, [&](size_t const source)
+		{
+			uint16_t * const h = &hops[source * n];
+			uint32_t * const f = &first_steps[source * n];
+
+			vector<NodeNum> queue{NodeNum{uint16_t(source)}};
+			h[source] = 0;
+
+			for (size_t i = 0; i != queue.size(); ++i)
+			{
+				NodeNum const u = queue[i];
+
+				foreach (step : out_steps(g, u))
+				{
+					NodeNum const v = to(g, step).node;
+					if (h[v.index] != none) continue;
+
+					h[v.index] = h[u.index] + 1;
+					f[v.index] = u.index == source ? uint32_t(step.seq.index) * 2 + step.reverse : f[u.index];
+					queue.push_back(v);
+				}
+			}
+		});
+}
+
+optional<unsigned> Distances::operator()(NodeNum const from, NodeNum const to) const
+{
+	uint16_t const h = hops[size_t(from.index) * n + to.index];
+	if (h == none) return boost::none;
+	return h;
+}
+
+optional<Step> Distances::first_step(NodeNum const from, NodeNum const to) const
+{
+	uint32_t const f = first_steps[size_t(from.index) * n + to.index];
+	if (f == no_step) return boost::none;
+	return Step{SeqNum{f / 2}, bool(f % 2)};
+}
+
+optional<Path> Distances::shortest_path(Graph const & g, NodeNum from, NodeNum const to) const
+{
+	if (!(*this)(from, to)) return boost::none;
+
+	Path p;
+
+	while (from != to)
+	{
+		Step const s = *first_step(from, to);
+		p.push_back(s);
+		from = GrappleMap::to(g, s).node;
+	}
+
+	return p;
+}
+
+void save(Distances const & d, string const filename)
+{
+	Header h;
+	std::memset(&h, 0, sizeof h);
+	std::memcpy(h.magic, magic, sizeof magic);
+	h.version = version;
+	h.byte_order_mark = byte_order_mark;
+	std::memcpy(h.topology, d.topology.data(), std::min(d.topology.size(), sizeof h.topology));
+	h.node_count = d.n;
+
+	string const tmp = filename + ".tmp";
+
+	{
+		std::ofstream f(tmp, std::ios::binary);
+		f.write(reinterpret_cast<char const *>(&h), sizeof h);
+		f.write(reinterpret_cast<char const *>(d.hops.data()), d.hops.size() * sizeof(uint16_t));
+		f.write(reinterpret_cast<char const *>(d.first_steps.data()), d.first_steps.size() * sizeof(uint32_t));
+		if (!f) error(tmp + ": write failed");
+	}
+
+	if (std::rename(tmp.c_str(), filename.c_str()) != 0)
+		error("could not rename " + tmp + " to " + filename + ": " + std::strerror(errno));
+}
+
+Distances loadDistances(Graph const & g, string const db_filename)
+{
+	string const filename = db_filename + ".distances";
+	string const topology = Distances::topology_of(g);
+
+	std::ifstream f(filename, std::ios::binary);
+	Header h;
+
+	if (f.read(reinterpret_cast<char *>(&h), sizeof h)
+		&& std::memcmp(h.magic, magic, sizeof magic) == 0
+		&& h.version == version
+		&& h.byte_order_mark == byte_order_mark
+		&& string(h.topology, sizeof h.topology) == topology
+		&& h.node_count == g.num_nodes())
+	{
+		Distances d;
+		d.n = h.node_count;
+		d.topology = topology;
+		d.hops.resize(size_t(d.n) * d.n);
+		d.first_steps.resize(size_t(d.n) * d.n);
+
+		if (f.read(reinterpret_cast<char *>(d.hops.data()), d.hops.size() * sizeof(uint16_t))
+			&& f.read(reinterpret_cast<char *>(d.first_steps.data()), d.first_steps.size() * sizeof(uint32_t)))
+			return d;
+	}
+
+	Distances d(g);
+
+	try { save(d, filename); }
+	catch (std::exception const & e) { std::cerr << "warning: " << e.what() << '\n'; }
+		// a read-only database is no reason to fail
+
+	return d;
+}
+
+}
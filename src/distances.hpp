@@ -0,0 +1,47 @@
+#ifndef GRAPPLEMAP_DISTANCES_HPP
+#define GRAPPLEMAP_DISTANCES_HPP
+
+#include "graph_util.hpp"
+
+namespace GrappleMap {
+
+class Distances
+	// The fewest transitions that get from each node to each other node, following
+	// sequences forward, and backward too if they are bidirectional, along with the
+	// first step of such a path, so that shortest paths can be read off without searching.
+{
+	unsigned n = 0;
+	vector<uint16_t> hops; // [from * n + to]
+	vector<uint32_t> first_steps; // likewise, as seq * 2 + reverse
+	string topology; // digest of what was searched
+
+	static uint16_t const none = 0xffff; // no path; also bounds the node count
+	static uint32_t const no_step = 0xffffffff;
+
+	friend Distances loadDistances(Graph const &, string);
+	friend void save(Distances const &, string);
+
+public:
+
+	Distances() = default;
+	explicit Distances(Graph const &); // searches breadth-first from every node, in parallel
+
+	static string topology_of(Graph const &);
+		// digest of the nodes and transitions, which is all the distances depend on
+
+	bool up_to_date(Graph const & g) const { return topology == topology_of(g); }
+
+	optional<unsigned> operator()(NodeNum from, NodeNum to) const;
+	optional<Step> first_step(NodeNum from, NodeNum to) const;
+	optional<Path> shortest_path(Graph const &, NodeNum from, NodeNum to) const;
+};
+
+Distances loadDistances(Graph const &, string db_filename);
+	// from db_filename + ".distances" if it was made for the same transitions,
+	// otherwise computed and saved there for next time (if possible)
+
+void save(Distances const &, string filename); // atomically
+
+}
+
+#endif
@@ -13,7 +13,7 @@
 #include <iomanip>
 #include <algorithm>
 #include <iterator>
-#include <stack>
+#include <deque>
 
 using namespace GrappleMap;
 
@@ -67,10 +67,9 @@ optional<NextPosition> determineNextPos(
 			}
 		};
 
-	foreach (p : viables[j].viables)
+	foreach (viable : viables[j].viables)
 	{
-		auto const & viable = p.second;
-		PositionInSequence other{p.first, viable.begin};
+		PositionInSequence other{viable.seqNum, viable.begin};
 
 		if (edit_mode && other.sequence != from.sequence) continue;
 
@@ -105,13 +104,35 @@ optional<NextPosition> determineNextPos(
 	return np;
 }
 
+struct UndoStep
+{
+	Graph::Journal changes;
+	PositionInSequence location;
+};
+
+size_t bytes(Graph::Journal const & j) // approximate
+{
+	size_t n = 0;
+
+	foreach (c : j)
+	{
+		n += sizeof c;
+		if (c.edge) n += c.edge->sequence.positions.size() * sizeof(Position);
+	}
+
+	return n;
+}
+
 struct Window
 {
 	explicit Window(string const f)
-		: filename(f), graph(loadGraph(filename))
-	{}
+		: filename(f), saver(filename), graph(loadGraph(filename))
+	{
+		graph.set_journaling(true);
+	}
 
 	string filename;
+	IncrementalSaver saver;
 	Graph graph;
 	PositionInSequence location{{0}, 0};
 	PlayerJoint closest_joint = {0, LeftAnkle};
@@ -121,11 +142,14 @@ struct Window
 	Camera camera;
 	bool split_view = false;
 	double jiggle = 0;
-	Viables viable;
+	ViablesCache viables;
+	Viables const * viable = nullptr;
 	PositionReorientation reorientation{};
 	optional<NextPosition> next_pos;
 	double last_cursor_x = 0, last_cursor_y = 0;
-	std::stack<std::pair<Graph, PositionInSequence>> undo;
+	std::deque<UndoStep> undo, redo;
+	size_t undo_bytes = 0;
+	static constexpr size_t max_undo_bytes = 64 << 20;
 	Style style;
 
 	std::map<NodeNum, unsigned> anim_next;
@@ -142,9 +166,62 @@ void print_status(Window const & w)
 		<< seq.description.front() << string(30, ' ') << std::flush;
 }
 
+void flush_changes(Window & w)
+	// moves the changes made since the last undo point into it
+{
+	Graph::Journal j = w.graph.take_journal();
+	if (j.empty()) return;
+
+	w.redo.clear();
+
+	if (w.undo.empty()) return;
+
+	w.undo_bytes += bytes(j);
+	append(w.undo.back().changes, move(j));
+
+	while (w.undo_bytes > Window::max_undo_bytes && w.undo.size() > 1)
+	{
+		w.undo_bytes -= bytes(w.undo.front().changes);
+		w.undo.pop_front();
+	}
+}
+
 void push_undo(Window & w)
 {
-	w.undo.emplace(w.graph, w.location);
+	flush_changes(w);
+	if (!w.undo.empty() && w.undo.back().changes.empty()) w.undo.pop_back();
+	w.undo.push_back(UndoStep{{}, w.location});
+}
+
+void undo(Window & w)
+{
+	flush_changes(w);
+	if (w.undo.empty()) return;
+
+	UndoStep const step = move(w.undo.back());
+	w.undo.pop_back();
+	w.undo_bytes -= bytes(step.changes);
+
+	w.graph.revert(step.changes);
+	w.redo.push_back(UndoStep{w.graph.take_journal(), w.location});
+	w.location = step.location;
+	w.next_pos = none;
+}
+
+void redo(Window & w)
+{
+	flush_changes(w);
+	if (w.redo.empty()) return;
+
+	UndoStep const step = move(w.redo.back());
+	w.redo.pop_back();
+
+	w.graph.revert(step.changes);
+	Graph::Journal j = w.graph.take_journal();
+	w.undo_bytes += bytes(j);
+	w.undo.push_back(UndoStep{move(j), w.location});
+	w.location = step.location;
+	w.next_pos = none;
 }
 
 void translate(Window & w, V3 const v)
@@ -164,14 +241,8 @@ void key_callback(GLFWwindow * const glfwWindow, int key, int /*scancode*/, int
 		if (mods & GLFW_MOD_CONTROL)
 			switch (key)
 			{
-				case GLFW_KEY_Z:
-					if (!w.undo.empty())
-					{
-						std::tie(w.graph, w.location) = w.undo.top();
-						w.undo.pop();
-						w.next_pos = none;
-					}
-					return;
+				case GLFW_KEY_Z: undo(w); return;
+				case GLFW_KEY_Y: redo(w); return;
 
 				case GLFW_KEY_C: // copy
 					w.clipboard = w.graph[w.location];
@@ -335,7 +406,7 @@ void key_callback(GLFWwindow * const glfwWindow, int key, int /*scancode*/, int
 				}
 				case GLFW_KEY_V: w.edit_mode = !w.edit_mode; break;
 
-				case GLFW_KEY_S: save(w.graph, w.filename); break;
+				case GLFW_KEY_S: w.saver.save(w.graph); break;
 
 				case GLFW_KEY_1: w.split_view = !w.split_view; break;
 
@@ -354,15 +425,13 @@ void key_callback(GLFWwindow * const glfwWindow, int key, int /*scancode*/, int
 
 				case GLFW_KEY_DELETE:
 				{
-					auto const before = make_pair(w.graph, w.location);
-
 					if (mods & GLFW_MOD_CONTROL)
 					{
 						push_undo(w);
 
 						if (auto const new_seq = erase_sequence(w.graph, w.location.sequence))
 							w.location = {*new_seq, 0};
-						else w.undo.pop();
+						else w.undo.pop_back();
 					}
 					else
 					{
@@ -370,7 +439,7 @@ void key_callback(GLFWwindow * const glfwWindow, int key, int /*scancode*/, int
 
 						if (auto const new_pos = w.graph.erase(w.location))
 							w.location.position = *new_pos;
-						else w.undo.pop();
+						else w.undo.pop_back();
 					}
 
 					break;
@@ -542,6 +611,7 @@ string const controls =
 	"  ctrl-c     - copy position to clipboard\n"
 	"  ctrl-v     - paste position from clipboard, overwriting current position\n"
 	"  ctrl-z     - undo\n"
+	"  ctrl-y     - redo\n"
 	"  page up    - go to previous transition\n"
 	"  page down  - go to next transition\n"
 	"  ctrl-del   - delete current transition\n"
@@ -637,8 +707,7 @@ int main(int const argc, char const * const * const argv)
 			{
 				w.camera.setViewportSize(v->fov, v->w * width, v->h * height);
 
-				foreach (j : playerJoints)
-					w.viable[j] = determineViables(w.graph, w.location, j, w.edit_mode, w.camera, w.reorientation);
+				w.viable = &w.viables(w.graph, w.location, w.edit_mode, w.camera, w.reorientation);
 
 				double xpos, ypos;
 				glfwGetCursorPos(window, &xpos, &ypos);
@@ -655,7 +724,7 @@ int main(int const argc, char const * const * const argv)
 
 			if (cursor)
 				if (auto best_next_pos = determineNextPos(
-						w.viable, w.graph, w.chosen_joint ? *w.chosen_joint : w.closest_joint,
+						*w.viable, w.graph, w.chosen_joint ? *w.chosen_joint : w.closest_joint,
 						{w.location.sequence, w.location.position}, w.reorientation, w.camera, *cursor, w.edit_mode))
 				{
 					if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS)
@@ -739,7 +808,7 @@ int main(int const argc, char const * const * const argv)
 
 			glfwGetFramebufferSize(window, &width, &height);
 			renderWindow(
-				views, &w.viable, w.graph, posToDraw, w.camera, special_joint,
+				views, w.viable, w.graph, posToDraw, w.camera, special_joint,
 				w.edit_mode, 0, 0, width, height, w.location.sequence, w.style);
 
 			glfwSwapBuffers(window);
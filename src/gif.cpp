@@ -0,0 +1,281 @@
+#include "gif.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+namespace GrappleMap {
+
+namespace
+{
+	uint8_t const transparent = 255;
+
+	unsigned cell(RGB const c) // 5 bits per channel
+	{
+		return (c.r >> 3) << 10 | (c.g >> 3) << 5 | (c.b >> 3);
+	}
+
+	struct Palette
+	{
+		vector<RGB> colors; // at most 255, leaving the last index for transparency
+		vector<uint8_t> index; // by cell
+	};
+
+	Palette popularity_palette(vector<Image> const & frames)
+		// The most common cells' average colors. The scenes are mostly
+		// background and two player colors, so this loses very little.
+	{
+		struct Bin { uint64_t count = 0, r = 0, g = 0, b = 0; };
+
+		vector<Bin> bins(1 << 15);
+
+		foreach (f : frames)
+		foreach (p : f.pixels)
+		{
+			Bin & b = bins[cell(p)];
+			++b.count;
+			b.r += p.r;
+			b.g += p.g;
+			b.b += p.b;
+		}
+
+		vector<unsigned> used;
+		for (unsigned c = 0; c != bins.size(); ++c)
+			if (bins[c].count) used.push_back(c);
+
+		std::stable_sort(used.begin(), used.end(),
+			[&](unsigned const a, unsigned const b) { return bins[a].count > bins[b].count; });
+
+		if (used.size() > transparent) used.resize(transparent);
+
+		Palette p;
+
+		foreach (c : used)
+		{
+			Bin const & b = bins[c];
+			p.colors.push_back(RGB{uint8_t(b.r / b.count), uint8_t(b.g / b.count), uint8_t(b.b / b.count)});
+		}
+
+		p.index.resize(bins.size());
+
+		for (unsigned c = 0; c != bins.size(); ++c)
+		{
+			Bin const & b = bins[c];
+			if (!b.count) continue;
+
+			int const r = b.r / b.count, g = b.g / b.count, bl = b.b / b.count;
+
+			int best = std::numeric_limits<int>::max();
+
+			for (unsigned i = 0; i != p.colors.size(); ++i)
+			{
+				RGB const & q = p.colors[i];
+				int const d = (q.r - r) * (q.r - r) + (q.g - g) * (q.g - g) + (q.b - bl) * (q.b - bl);
+				if (d < best) { best = d; p.index[c] = i; }
+			}
+		}
+
+		return p;
+	}
+
+	struct Frame
+	{
+		unsigned x, y, width, height;
+		vector<uint8_t> pixels; // palette indices
+		unsigned delay;
+	};
+
+	vector<Frame> frames_for(vector<Image> const & images, Palette const & palette, unsigned const delay)
+	{
+		vector<Frame> frames;
+
+		unsigned const width = images.front().width, height = images.front().height;
+
+		vector<uint8_t> canvas, current(width * height);
+
+		foreach (image : images)
+		{
+			if (image.width != width || image.height != height)
+				error("gif frames differ in size");
+
+			for (size_t i = 0; i != current.size(); ++i)
+				current[i] = palette.index[cell(image.pixels[i])];
+
+			if (canvas.empty())
+			{
+				frames.push_back(Frame{0, 0, width, height, current, delay});
+				canvas = current;
+				continue;
+			}
+
+			unsigned x0 = width, y0 = height, x1 = 0, y1 = 0; // changed rectangle, inclusive
+
+			for (unsigned y = 0; y != height; ++y)
+			for (unsigned x = 0; x != width; ++x)
+				if (current[y * width + x] != canvas[y * width + x])
+				{
+					x0 = std::min(x0, x); x1 = std::max(x1, x);
+					y0 = std::min(y0, y); y1 = std::max(y1, y);
+				}
+
+			if (x0 == width)
+			{
+				frames.back().delay += delay;
+				continue;
+			}
+
+			Frame f{x0, y0, x1 - x0 + 1, y1 - y0 + 1, {}, delay};
+
+			for (unsigned y = y0; y <= y1; ++y)
+			for (unsigned x = x0; x <= x1; ++x)
+			{
+				uint8_t & c = canvas[y * width + x];
+				uint8_t const n = current[y * width + x];
+				f.pixels.push_back(n == c ? transparent : n);
+				c = n;
+			}
+
+			frames.push_back(move(f));
+		}
+
+		return frames;
+	}
+
+	void put16(string & out, unsigned const v)
+	{
+		out += char(v & 0xff);
+		out += char(v >> 8);
+	}
+
+	void lzw(vector<uint8_t> const & in, string & out)
+	{
+		unsigned const min_code_size = 8, clear = 1 << min_code_size, eoi = clear + 1;
+
+		vector<uint16_t> dict(4096 << 8);
+			// code for prefix code * 256 + next byte, 0 if not yet assigned
+
+		string bytes;
+		uint32_t bits = 0;
+		unsigned nbits = 0;
+
+		auto emit = [&](unsigned const code, unsigned const size)
+			{
+				bits |= code << nbits;
+				nbits += size;
+				for (; nbits >= 8; nbits -= 8, bits >>= 8) bytes += char(bits & 0xff);
+			};
+
+		unsigned size = min_code_size + 1, last = eoi;
+			// the decoder adds an entry for every code it reads, and widens codes once
+			// the next entry no longer fits, so both are tracked for every code emitted
+
+		auto emitted = [&]
+			{
+				if (++last >= (1u << size)) ++size;
+			};
+
+		emit(clear, size);
+
+		int cur = -1;
+
+		foreach (b : in)
+		{
+			if (cur < 0) { cur = b; continue; }
+
+			uint16_t & d = dict[cur << 8 | b];
+			if (d) { cur = d; continue; }
+
+			emit(cur, size);
+			d = last + 1;
+			emitted();
+
+			if (last == 4095)
+			{
+				emit(clear, size);
+				std::fill(dict.begin(), dict.end(), 0);
+				size = min_code_size + 1;
+				last = eoi;
+			}
+
+			cur = b;
+		}
+
+		if (cur >= 0)
+		{
+			emit(cur, size);
+			emitted();
+		}
+
+		emit(eoi, size);
+		if (nbits) bytes += char(bits & 0xff);
+
+		out += char(min_code_size);
+
+		for (size_t i = 0; i < bytes.size(); i += 255)
+		{
+			size_t const n = std::min<size_t>(255, bytes.size() - i);
+			out += char(n);
+			out.append(bytes, i, n);
+		}
+
+		out += char(0);
+	}
+}
+
+void write_gif(string const & path, vector<Image> const & images, unsigned const delay)
+{
+	if (images.empty()) error("gif without frames");
+
+	Palette const palette = popularity_palette(images);
+
+	string out = "GIF89a";
+	put16(out, images.front().width);
+	put16(out, images.front().height);
+	out += char(0xf7); // 256 color global table
+	out += char(0); // background color
+	out += char(0); // aspect ratio
+
+	for (unsigned i = 0; i != 256; ++i)
+	{
+		RGB const c = i < palette.colors.size() ? palette.colors[i] : RGB{0, 0, 0};
+		out += char(c.r);
+		out += char(c.g);
+		out += char(c.b);
+	}
+
+	out += "\x21\xff\x0bNETSCAPE2.0\x03\x01";
+	put16(out, 0); // loop forever
+	out += char(0);
+
+	foreach (f : frames_for(images, palette, delay))
+	{
+		out += "\x21\xf9\x04";
+		out += char(1 << 2 | 1); // keep the previous frame, use transparency
+		put16(out, f.delay);
+		out += char(transparent);
+		out += char(0);
+
+		out += char(0x2c);
+		put16(out, f.x);
+		put16(out, f.y);
+		put16(out, f.width);
+		put16(out, f.height);
+		out += char(0);
+
+		lzw(f.pixels, out);
+	}
+
+	out += char(0x3b);
+
+	string const tmp = path + ".tmp";
+
+	{
+		std::ofstream f(tmp, std::ios::binary);
+		f << out;
+		if (!f) error("could not write to " + tmp);
+	}
+
+	if (std::rename(tmp.c_str(), path.c_str()) != 0)
+		error("could not rename " + tmp + " to " + path);
+}
+
+}
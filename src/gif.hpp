@@ -0,0 +1,15 @@
+#ifndef GRAPPLEMAP_GIF_HPP
+#define GRAPPLEMAP_GIF_HPP
+
+#include "image.hpp"
+
+namespace GrappleMap {
+
+void write_gif(string const & path, vector<Image> const & frames, unsigned delay);
+	// Writes a looping animation with one palette for all frames. After the first frame,
+	// only the rectangle that changed is stored, with unchanged pixels transparent.
+	// The delay is in hundredths of a second. All frames must have the same size.
+
+}
+
+#endif
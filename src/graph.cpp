@@ -1,7 +1,78 @@
 #include "graph_util.hpp"
+#include <atomic>
 
 namespace GrappleMap {
 
+namespace
+{
+	uint64_t new_stamp()
+	{
+		static std::atomic<uint64_t> last{0};
+		return ++last;
+	}
+
+	// is_reoriented(a, b) aligns a to b by the first player's head and the xz direction
+	// from the first player's head to the second's, and then requires the squared joint
+	// distances to sum to less than 0.03. Expressed in coordinates relative to that same
+	// frame, the joints of matching positions are therefore within sqrt(0.03) of eachother.
+
+	double const node_cell_size = 0.18; // > sqrt(0.03), so matching cells differ by at most one
+
+	Graph::NodeFeatures node_features(Position const & p)
+	{
+		V3 const h = p[0][Head];
+		double const a = angle(xz(p[1][Head] - h));
+		double const s = std::sin(a), c = std::cos(a);
+
+		auto rel = [&](V3 const v)
+			{
+				V3 const d = v - h;
+				return V3{d.x * c - d.z * s, d.y, d.x * s + d.z * c};
+			};
+
+		return {{ rel(p[1][Head]), rel(p[0][Core]), rel(p[1][Core]) }};
+	}
+
+	Graph::NodeKey node_key(Graph::NodeFeatures const & f)
+	{
+		V3 const c = f[2];
+
+		return {{ int(std::floor(c.x / node_cell_size))
+		        , int(std::floor(c.y / node_cell_size))
+		        , int(std::floor(c.z / node_cell_size)) }};
+	}
+
+	bool may_match(Graph::NodeFeatures const & a, Graph::NodeFeatures const & b)
+	{
+		double u = 0;
+		for (unsigned i = 0; i != a.size(); ++i) u += distanceSquared(a[i], b[i]);
+		return u < 0.03;
+	}
+
+	SeqNum seqnum(SeqNum const s) { return s; }
+	SeqNum seqnum(Step const s) { return s.seq; }
+
+	template<typename T>
+	void insert_sorted(vector<T> & v, T const x)
+	{
+		v.insert(std::lower_bound(v.begin(), v.end(), x), x);
+	}
+
+	template<typename T>
+	void erase_seq(vector<T> & v, SeqNum const s)
+	{
+		v.erase(std::remove_if(v.begin(), v.end(), [&](T const & x){ return seqnum(x) == s; }), v.end());
+	}
+
+	array<Position, 4> variants(Position const & p)
+		// the variants that is_reoriented tries
+	{
+		Position swapped = p;
+		swap_players(swapped);
+		return {{ p, mirror(p), swapped, mirror(swapped) }};
+	}
+}
+
 Graph::Graph(vector<Node> const & nodes, vector<Sequence> const & sequences)
 {
 	foreach (n : nodes) insert(n);
@@ -9,48 +80,451 @@ Graph::Graph(vector<Node> const & nodes, vector<Sequence> const & sequences)
 	std::cerr << "Loaded " << nodes.size() << " nodes and " << edges.size() << " edges." << std::endl;
 }
 
+Graph::Graph(vector<Node> n, vector<Edge> e)
+	: nodes(move(n)), edges(move(e))
+{
+	foreach (m : nodenums(*this)) index_node(m);
+
+	foreach (edge : edges)
+		if (edge.from.node.index >= nodes.size() || edge.to.node.index >= nodes.size())
+			error("edge refers to nonexistent node");
+
+	node_tags.resize(nodes.size());
+	seq_tags.resize(edges.size());
+	seq_properties.resize(edges.size());
+	seq_desc_keys.resize(edges.size());
+	foreach (m : nodenums(*this)) describe(m);
+	foreach (sn : seqnums(*this)) describe(sn);
+
+	node_stamps.resize(nodes.size());
+	seq_stamps.resize(edges.size());
+	foreach (m : nodenums(*this)) touch(m);
+	foreach (sn : seqnums(*this)) touch(sn);
+
+	relink();
+
+	std::cerr << "Loaded " << nodes.size() << " nodes and " << edges.size() << " edges." << std::endl;
+}
+
+void Graph::touch(NodeNum const n)
+{
+	node_stamps[n.index] = graph_stamp = new_stamp();
+}
+
+void Graph::touch(SeqNum const s)
+{
+	seq_stamps[s.index] = graph_stamp = new_stamp();
+}
+
+void Graph::fit_tag_sets()
+{
+	foreach (t : node_tags) t.resize(tag_dict.size());
+	foreach (t : seq_tags) t.resize(tag_dict.size());
+	foreach (p : seq_properties) p.resize(property_dict.size());
+}
+
+void Graph::describe(NodeNum const n)
+{
+	vector<unsigned> v;
+	foreach (t : tags_in_desc(nodes[n.index].description)) v.push_back(tag_dict.intern(t));
+
+	fit_tag_sets();
+
+	TagSet & s = node_tags[n.index];
+	s.reset();
+	foreach (i : v) s.set(i);
+
+	if (!nodes[n.index].description.empty())
+		insert_sorted(nodes_by_desc[desc_key(nodes[n.index].description)], n);
+			// node descriptions only change by adding and removing nodes
+}
+
+void Graph::describe(SeqNum const sn)
+{
+	auto const & desc = edges[sn.index].sequence.description;
+
+	vector<unsigned> t, p;
+	foreach (x : tags_in_desc(desc)) t.push_back(tag_dict.intern(x));
+	foreach (x : properties_in_desc(desc)) p.push_back(property_dict.intern(x));
+
+	fit_tag_sets();
+
+	seq_tags[sn.index].reset();
+	foreach (i : t) seq_tags[sn.index].set(i);
+
+	seq_properties[sn.index].reset();
+	foreach (i : p) seq_properties[sn.index].set(i);
+
+	index_desc(sn);
+}
+
+string Graph::desc_key(vector<string> const & description)
+{
+	return description.empty() ? string() : replace_all(description.front(), "\\n", " ");
+}
+
+void Graph::index_desc(SeqNum const sn)
+{
+	string & key = seq_desc_keys[sn.index];
+
+	auto const i = seqs_by_desc.find(key);
+	if (i != seqs_by_desc.end())
+	{
+		auto & v = i->second;
+		v.erase(std::remove(v.begin(), v.end(), sn), v.end());
+		if (v.empty()) seqs_by_desc.erase(i);
+	}
+
+	key = desc_key(edges[sn.index].sequence.description);
+	insert_sorted(seqs_by_desc[key], sn);
+}
+
+void Graph::reindex_seq_descs()
+{
+	seqs_by_desc.clear();
+	foreach (sn : seqnums(*this)) seqs_by_desc[seq_desc_keys[sn.index]].push_back(sn);
+}
+
+vector<NodeNum> const & Graph::nodes_described(string const & key) const
+{
+	static vector<NodeNum> const no_nodes;
+	auto const i = nodes_by_desc.find(key);
+	return i == nodes_by_desc.end() ? no_nodes : i->second;
+}
+
+vector<SeqNum> const & Graph::sequences_described(string const & key) const
+{
+	static vector<SeqNum> const no_seqs;
+	auto const i = seqs_by_desc.find(key);
+	return i == seqs_by_desc.end() ? no_seqs : i->second;
+}
+
+void Graph::index_node(NodeNum const n)
+{
+	NodeFeatures const f = node_features(nodes[n.index].position);
+	node_index[node_key(f)].push_back(IndexedNode{n, f});
+}
+
+void Graph::unindex_node(NodeNum const n)
+{
+	auto i = node_index.find(node_key(node_features(nodes[n.index].position)));
+	assert(i != node_index.end());
+
+	auto & v = i->second;
+	v.erase(std::find_if(v.begin(), v.end(), [&](IndexedNode const & x){ return x.node == n; }));
+	if (v.empty()) node_index.erase(i);
+}
+
+void Graph::link(SeqNum const s)
+{
+	Edge const & e = edges[s.index];
+	Adjacency & from = adjacency[e.from.node.index];
+	Adjacency & to = adjacency[e.to.node.index];
+
+	insert_sorted(from.out, s);
+	insert_sorted(to.in, s);
+	insert_sorted(from.out_steps, Step{s, false});
+	insert_sorted(to.in_steps, Step{s, false});
+
+	if (is_bidirectional(*this, s))
+	{
+		insert_sorted(to.out_steps, Step{s, true});
+		insert_sorted(from.in_steps, Step{s, true});
+	}
+}
+
+void Graph::unlink(SeqNum const s)
+{
+	Edge const & e = edges[s.index];
+
+	foreach (n : {e.from.node, e.to.node})
+	{
+		Adjacency & a = adjacency[n.index];
+		erase_seq(a.in, s);
+		erase_seq(a.out, s);
+		erase_seq(a.in_steps, s);
+		erase_seq(a.out_steps, s);
+	}
+}
+
+void Graph::relink()
+{
+	adjacency.assign(nodes.size(), Adjacency());
+	foreach (s : seqnums(*this)) link(s);
+}
+
+// primitive changes, each recorded in the journal
+
+namespace
+{
+	bool same_target(Graph::Change const & a, Graph::Change const & b)
+	{
+		if (a.kind != b.kind) return false;
+
+		switch (a.kind)
+		{
+			case Graph::Change::PositionReplaced: return a.pis == b.pis;
+			case Graph::Change::EndsRelinked: return a.pis.sequence == b.pis.sequence;
+			case Graph::Change::NodeMoved: return a.node == b.node;
+			default: return false;
+		}
+	}
+
+	bool is_update(Graph::Change const & c)
+	{
+		return c.kind == Graph::Change::PositionReplaced
+			|| c.kind == Graph::Change::EndsRelinked
+			|| c.kind == Graph::Change::NodeMoved;
+	}
+}
+
+void Graph::record(Change c)
+{
+	if (!journaling) return;
+
+	// Only the oldest state matters for reverting, so repeated updates of the same thing
+	// (like while dragging a joint) are coalesced, as long as nothing that could shift
+	// indices happened in between.
+
+	if (is_update(c))
+		for (auto i = journal.rbegin(); i != journal.rend() && is_update(*i); ++i)
+			if (same_target(*i, c)) return;
+
+	journal.push_back(move(c));
+}
+
+void Graph::replace_position(PositionInSequence const pis, Position const & p)
+{
+	Position & q = edges.at(pis.sequence.index).sequence.positions.at(pis.position);
+
+	Change c{Change::PositionReplaced};
+	c.pis = pis;
+	c.position = q;
+	record(move(c));
+
+	q = p;
+	touch(pis.sequence);
+}
+
+void Graph::insert_position(PositionInSequence const pis, Position const & p)
+{
+	auto & positions = edges.at(pis.sequence.index).sequence.positions;
+
+	Change c{Change::PositionInserted};
+	c.pis = pis;
+	record(move(c));
+
+	positions.insert(positions.begin() + pis.position, p);
+	touch(pis.sequence);
+}
+
+void Graph::erase_position(PositionInSequence const pis)
+{
+	auto & positions = edges.at(pis.sequence.index).sequence.positions;
+
+	Change c{Change::PositionErased};
+	c.pis = pis;
+	c.position = positions.at(pis.position);
+	record(move(c));
+
+	positions.erase(positions.begin() + pis.position);
+	touch(pis.sequence);
+}
+
+void Graph::relink_ends(SeqNum const s, ReorientedNode const & from, ReorientedNode const & to)
+{
+	Edge & e = edges.at(s.index);
+
+	Change c{Change::EndsRelinked};
+	c.pis.sequence = s;
+	c.ends = {{e.from, e.to}};
+	record(move(c));
+
+	unlink(s);
+	e.from = from;
+	e.to = to;
+	link(s);
+	touch(s);
+}
+
+void Graph::move_node(NodeNum const n, Position const & p)
+{
+	Change c{Change::NodeMoved};
+	c.node = n;
+	c.position = nodes.at(n.index).position;
+	record(move(c));
+
+	unindex_node(n);
+	nodes[n.index].position = p;
+	index_node(n);
+	touch(n);
+}
+
+void Graph::insert(Node n)
+{
+	nodes.emplace_back(move(n));
+	adjacency.emplace_back();
+	node_tags.emplace_back();
+	node_stamps.emplace_back();
+
+	NodeNum const m{uint16_t(nodes.size() - 1)};
+	index_node(m);
+	describe(m);
+	touch(m);
+
+	Change c{Change::NodeAdded};
+	c.node = m;
+	record(move(c));
+}
+
+void Graph::pop_node()
+{
+	NodeNum const m{uint16_t(nodes.size() - 1)};
+
+	assert(adjacency.back().in.empty() && adjacency.back().out.empty());
+
+	Change c{Change::NodeRemoved};
+	c.node = m;
+	c.removed_node = nodes.back();
+	record(move(c));
+
+	unindex_node(m);
+
+	if (!nodes.back().description.empty())
+	{
+		auto const i = nodes_by_desc.find(desc_key(nodes.back().description));
+		i->second.pop_back(); // m is the highest
+		if (i->second.empty()) nodes_by_desc.erase(i);
+	}
+
+	nodes.pop_back();
+	adjacency.pop_back();
+	node_tags.pop_back();
+	node_stamps.pop_back();
+	graph_stamp = new_stamp();
+}
+
+void Graph::replace_edge(SeqNum const s, Edge const & e)
+{
+	Change c{Change::SequenceReplaced};
+	c.pis.sequence = s;
+	c.edge = edges.at(s.index);
+	record(move(c));
+
+	unlink(s);
+	edges[s.index] = e;
+	describe(s);
+	touch(s);
+	link(s);
+}
+
+void Graph::insert_edge(SeqNum const s, Edge const & e)
+{
+	Change c{Change::SequenceInserted};
+	c.pis.sequence = s;
+	record(move(c));
+
+	edges.insert(edges.begin() + s.index, e);
+	seq_tags.emplace(seq_tags.begin() + s.index);
+	seq_properties.emplace(seq_properties.begin() + s.index);
+	seq_stamps.emplace(seq_stamps.begin() + s.index);
+	seq_desc_keys.emplace(seq_desc_keys.begin() + s.index);
+
+	describe(s);
+	touch(s);
+
+	if (s.index == edges.size() - 1) link(s);
+	else // seqnums past the inserted one shift up
+	{
+		relink();
+		reindex_seq_descs();
+	}
+}
+
+void Graph::erase_edge(SeqNum const s)
+{
+	Change c{Change::SequenceErased};
+	c.pis.sequence = s;
+	c.edge = edges.at(s.index);
+	record(move(c));
+
+	edges.erase(edges.begin() + s.index);
+	seq_tags.erase(seq_tags.begin() + s.index);
+	seq_properties.erase(seq_properties.begin() + s.index);
+	seq_stamps.erase(seq_stamps.begin() + s.index);
+	seq_desc_keys.erase(seq_desc_keys.begin() + s.index);
+	graph_stamp = new_stamp();
+	relink(); // seqnums past the erased one shift down
+	reindex_seq_descs();
+}
+
+void Graph::revert(Journal const & j)
+{
+	for (auto i = j.rbegin(); i != j.rend(); ++i)
+		switch (i->kind)
+		{
+			case Change::PositionReplaced: replace_position(i->pis, *i->position); break;
+			case Change::PositionInserted: erase_position(i->pis); break;
+			case Change::PositionErased: insert_position(i->pis, *i->position); break;
+			case Change::EndsRelinked: relink_ends(i->pis.sequence, i->ends[0], i->ends[1]); break;
+			case Change::NodeMoved: move_node(i->node, *i->position); break;
+			case Change::NodeAdded: pop_node(); break;
+			case Change::NodeRemoved: insert(*i->removed_node); break;
+			case Change::SequenceReplaced: replace_edge(i->pis.sequence, *i->edge); break;
+			case Change::SequenceInserted: erase_edge(i->pis.sequence); break;
+			case Change::SequenceErased: insert_edge(i->pis.sequence, *i->edge); break;
+		}
+}
+
+Graph::Journal Graph::take_journal()
+{
+	Journal j;
+	swap(j, journal);
+	return j;
+}
+
+// compound changes
+
 void Graph::changed(PositionInSequence const pis)
 {
-	Edge & edge = edges.at(pis.sequence.index);
+	Edge const & edge = edges.at(pis.sequence.index);
+
+	ReorientedNode from = edge.from, to = edge.to;
 
 	if (pis.position == 0)
 	{
-		auto const new_from = find_or_add(edge.sequence.positions.front());
+		from = find_or_add(edge.sequence.positions.front());
 
-		if (new_from.node != edge.from.node)
+		if (from.node != edge.from.node)
 			std::cerr << "Front of sequence is now a different node." << std::endl;
-
-		edge.from = new_from;
 	}
 	else if (!next(*this, pis))
 	{
-		auto const new_to = find_or_add(edge.sequence.positions.back());
+		to = find_or_add(edge.sequence.positions.back());
 
-		if (new_to.node != edge.to.node)
+		if (to.node != edge.to.node)
 			std::cerr << "Back of sequence is now a different node." << std::endl;
-
-		edge.to = new_to;
 	}
+	else return;
+
+	relink_ends(pis.sequence, from, to);
 }
 
 void Graph::replace(PositionInSequence const pis, Position const & p, bool const local)
 {
-	edges.at(pis.sequence.index).sequence.positions.at(pis.position) = p;
+	replace_position(pis, p);
 
 	optional<ReorientedNode> const rn = node(*this, pis);
 	if (!local && rn)
 	{
-		nodes[rn->node.index].position = inverse(rn->reorientation)(p);
+		move_node(rn->node, inverse(rn->reorientation)(p));
 		assert(basicallySame((*this)[*rn], p));
 
-		foreach (e : edges)
-		{
-			if (e.from.node == rn->node)
-				e.sequence.positions.front() = (*this)[e.from];
+		foreach (s : adjacency[rn->node.index].out)
+			replace_position(first_pos_in(s), (*this)[edges[s.index].from]);
 
-			if (e.to.node == rn->node)
-				e.sequence.positions.back() = (*this)[e.to];
-		}
+		foreach (s : adjacency[rn->node.index].in)
+			replace_position(last_pos_in(*this, s), (*this)[edges[s.index].to]);
 	}
 	else changed(pis);
 
@@ -59,9 +533,8 @@ void Graph::replace(PositionInSequence const pis, Position const & p, bool const
 
 void Graph::clone(PositionInSequence const pis)
 {
-	auto & positions =  edges.at(pis.sequence.index).sequence.positions;
-	Position const p = positions.at(pis.position);
-	positions.insert(positions.begin() + pis.position, p);
+	Position const p = (*this)[pis];
+	insert_position(pis, p);
 }
 
 void Graph::set(optional<SeqNum> const num, optional<Sequence> const seq)
@@ -73,27 +546,21 @@ void Graph::set(optional<SeqNum> const num, optional<Sequence> const seq)
 			find_or_add(seq->positions.back()),
 			*seq};
 
-		if (num)
-			edges[num->index] = e;
-		else
-			edges.push_back(e);
+		if (num) replace_edge(*num, e);
+		else insert_edge(SeqNum{num_sequences()}, e);
 	}
-	else if (num)
-		edges.erase(edges.begin() + num->index);
+	else if (num) erase_edge(*num);
 }
 
 optional<PosNum> Graph::erase(PositionInSequence const pis)
 {
-	auto & edge = edges.at(pis.sequence.index);
-	auto & positions = edge.sequence.positions;
-
-	if (positions.size() == 2)
+	if (edges.at(pis.sequence.index).sequence.positions.size() == 2)
 	{
 		std::cerr << "Cannot erase either of last two elements in sequence." << std::endl;
 		return none;
 	}
 
-	positions.erase(positions.begin() + pis.position);
+	erase_position(pis);
 
 	auto const pos = std::min(pis.position, last_pos(*this, pis.sequence));
 
@@ -104,7 +571,30 @@ optional<PosNum> Graph::erase(PositionInSequence const pis)
 
 optional<ReorientedNode> Graph::is_reoriented_node(Position const & p) const
 {
-	foreach(n : nodenums(*this))
+	vector<NodeNum> candidates;
+
+	foreach (v : variants(p))
+	{
+		NodeFeatures const f = node_features(v);
+		NodeKey const k = node_key(f);
+
+		for (int x = -1; x <= 1; ++x)
+		for (int y = -1; y <= 1; ++y)
+		for (int z = -1; z <= 1; ++z)
+		{
+			auto const i = node_index.find(NodeKey{{k[0] + x, k[1] + y, k[2] + z}});
+			if (i != node_index.end())
+				foreach (n : i->second)
+					if (may_match(n.features, f))
+						candidates.push_back(n.node);
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+		// prefer the lowest-numbered match, like a linear scan would
+
+	foreach(n : candidates)
 		if (auto r = is_reoriented(nodes[n.index].position, p))
 			return ReorientedNode{n, *r};
 
@@ -2,6 +2,8 @@
 #define GRAPPLEMAP_GRAPH_HPP
 
 #include "positions.hpp"
+#include <boost/dynamic_bitset.hpp>
+#include <unordered_map>
 
 namespace GrappleMap {
 
@@ -29,6 +31,45 @@ struct ReorientedSequence
 	PositionReorientation reorientation;
 };
 
+struct Step { SeqNum seq; bool reverse; };
+
+inline bool operator==(Step const a, Step const b)
+{
+	return a.seq == b.seq && a.reverse == b.reverse;
+}
+
+inline bool operator<(Step const a, Step const b)
+{
+	return std::tie(a.seq, a.reverse) < std::tie(b.seq, b.reverse);
+}
+
+using TagSet = boost::dynamic_bitset<>; // indexed by Dictionary number
+
+struct Dictionary
+{
+	unsigned intern(string const & name)
+	{
+		auto const i = numbers.emplace(name, names.size());
+		if (i.second) names.push_back(name);
+		return i.first->second;
+	}
+
+	optional<unsigned> find(string const & name) const
+	{
+		auto const i = numbers.find(name);
+		if (i == numbers.end()) return none;
+		return i->second;
+	}
+
+	string const & operator[](unsigned const i) const { return names[i]; }
+	unsigned size() const { return names.size(); }
+
+private:
+
+	vector<string> names;
+	map<string, unsigned> numbers;
+};
+
 struct Graph
 {
 	struct Node
@@ -45,11 +86,106 @@ struct Graph
 			// invariant: g[to] == sequences.positions.back()
 	};
 
+	struct Change
+		// a primitive change, holding what is needed to revert it
+	{
+		enum Kind
+		{
+			PositionReplaced, // position at pis was *position
+			PositionInserted, // at pis
+			PositionErased, // position at pis was *position
+			EndsRelinked, // pis.sequence's from and to were ends
+			NodeMoved, // node's position was *position
+			NodeAdded, // node is the last one
+			NodeRemoved, // node was the last one, and was *removed_node
+			SequenceReplaced, // edge pis.sequence was *edge
+			SequenceInserted, // at pis.sequence
+			SequenceErased // edge pis.sequence was *edge
+		};
+
+		Kind kind;
+		PositionInSequence pis = {};
+		NodeNum node = {};
+		optional<Position> position = {};
+		optional<Node> removed_node = {};
+		optional<Edge> edge = {};
+		array<ReorientedNode, 2> ends = {};
+	};
+
+	using Journal = vector<Change>;
+
+	using NodeKey = array<int, 3>;
+	using NodeFeatures = array<V3, 3>;
+
 private:
 
 	vector<Node> nodes;
 	vector<Edge> edges; // indexed by seqnum
 
+	struct IndexedNode { NodeNum node; NodeFeatures features; };
+
+	map<NodeKey, vector<IndexedNode>> node_index;
+		// buckets nodes by a few joints expressed relative to the first player's head,
+		// so that is_reoriented_node only has to check nearby buckets
+
+	void index_node(NodeNum);
+	void unindex_node(NodeNum);
+
+	struct Adjacency
+	{
+		vector<SeqNum> in, out;
+		vector<Step> in_steps, out_steps; // including reverse steps of bidirectional sequences
+	};
+
+	vector<Adjacency> adjacency; // indexed by nodenum, each list sorted
+
+	void link(SeqNum);
+	void unlink(SeqNum);
+	void relink();
+
+	Dictionary tag_dict, property_dict;
+	vector<TagSet> node_tags; // indexed by nodenum
+	vector<TagSet> seq_tags, seq_properties; // indexed by seqnum
+		// all sized to their dictionary, recomputed when a description changes
+
+	void describe(NodeNum);
+	void describe(SeqNum);
+	void fit_tag_sets();
+
+	std::unordered_map<string, vector<NodeNum>> nodes_by_desc;
+	std::unordered_map<string, vector<SeqNum>> seqs_by_desc;
+		// by first description line, each list sorted
+	vector<string> seq_desc_keys; // indexed by seqnum, what seqs_by_desc has it under
+
+	void index_desc(SeqNum);
+	void reindex_seq_descs(); // after seqnums shift
+
+	vector<uint64_t> node_stamps; // indexed by nodenum
+	vector<uint64_t> seq_stamps; // indexed by seqnum
+		// renewed from a process-wide counter whenever the node or sequence changes,
+		// so equal stamps mean equal content, even across copies of the graph
+	uint64_t graph_stamp = 0; // renewed by every change
+
+	void touch(NodeNum);
+	void touch(SeqNum);
+
+	bool journaling = false;
+	Journal journal;
+
+	void record(Change);
+
+	// primitive changes, recorded in the journal and keeping all indices up to date
+
+	void replace_position(PositionInSequence, Position const &);
+	void insert_position(PositionInSequence, Position const &);
+	void erase_position(PositionInSequence);
+	void relink_ends(SeqNum, ReorientedNode const & from, ReorientedNode const & to);
+	void move_node(NodeNum, Position const &);
+	void pop_node();
+	void replace_edge(SeqNum, Edge const &);
+	void insert_edge(SeqNum, Edge const &);
+	void erase_edge(SeqNum);
+
 	optional<ReorientedNode> is_reoriented_node(Position const &) const;
 
 	ReorientedNode find_or_add(Position const & p)
@@ -57,7 +193,7 @@ private:
 		if (auto m = is_reoriented_node(p))
 			return *m;
 
-		nodes.push_back(Node{p, vector<string>()});
+		insert(Node{p, vector<string>()});
 		return ReorientedNode{NodeNum{uint16_t(nodes.size() - 1)}, PositionReorientation{}};
 	}
 
@@ -68,6 +204,8 @@ public:
 	// construction
 
 	explicit Graph(vector<Node> const &, vector<Sequence> const &);
+	explicit Graph(vector<Node>, vector<Edge>);
+		// edges must already be linked to the given nodes
 
 	// const access
 
@@ -88,12 +226,34 @@ public:
 	ReorientedNode const & from(SeqNum const s) const { return edges[s.index].from; }
 	ReorientedNode const & to(SeqNum const s) const { return edges[s.index].to; }
 
+	vector<SeqNum> const & in(NodeNum const n) const { return adjacency[n.index].in; }
+	vector<SeqNum> const & out(NodeNum const n) const { return adjacency[n.index].out; }
+	vector<Step> const & in_steps(NodeNum const n) const { return adjacency[n.index].in_steps; }
+	vector<Step> const & out_steps(NodeNum const n) const { return adjacency[n.index].out_steps; }
+
+	Dictionary const & tag_dictionary() const { return tag_dict; }
+	Dictionary const & property_dictionary() const { return property_dict; }
+
+	TagSet const & tags(NodeNum const n) const { return node_tags[n.index]; }
+	TagSet const & tags(SeqNum const s) const { return seq_tags[s.index]; }
+	TagSet const & properties(SeqNum const s) const { return seq_properties[s.index]; }
+
+	uint64_t stamp(NodeNum const n) const { return node_stamps[n.index]; }
+	uint64_t stamp(SeqNum const s) const { return seq_stamps[s.index]; }
+	uint64_t stamp() const { return graph_stamp; }
+
+	static string desc_key(vector<string> const & description);
+		// the first line, with "\\n" (which marks line breaks in the database) as a space
+
+	vector<NodeNum> const & nodes_described(string const & key) const;
+	vector<SeqNum> const & sequences_described(string const & key) const;
+
 	uint16_t num_sequences() const { return edges.size(); }
 	uint16_t num_nodes() const { return nodes.size(); }
 
 	// mutation
 
-	void insert(Node n) { nodes.emplace_back(move(n)); }
+	void insert(Node);
 	void replace(PositionInSequence, Position const &, bool local);
 		// The local flag only affects the case where the position denotes a node.
 		// In that case, if local is true, the existing node and connecting sequences
@@ -107,6 +267,17 @@ public:
 		// no sequence means erase
 		// neither means noop
 		// both means replace
+
+	// journal
+
+	void set_journaling(bool const b) { journaling = b; }
+
+	Journal take_journal();
+		// returns the changes recorded since the previous call
+
+	void revert(Journal const &);
+		// Undoes the given changes, most recent first. If journaling, the changes this makes
+		// are recorded in turn, so reverting those redoes the original ones.
 };
 
 }
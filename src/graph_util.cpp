@@ -1,4 +1,6 @@
 #include "graph_util.hpp"
+#include <functional>
+#include <queue>
 
 namespace GrappleMap {
 
@@ -29,19 +31,42 @@ optional<SeqNum> erase_sequence(Graph & g, SeqNum const sn)
 	return SeqNum{sn.index == 0 ? 0 : sn.index - 1};
 }
 
+namespace
+{
+	optional<unsigned> numbered(char const prefix, string const & desc)
+		// n for desc == prefix + to_string(n)
+	{
+		if (desc.size() < 2 || desc.size() > 6 || desc.front() != prefix) return none;
+
+		string const digits = desc.substr(1);
+		if (!all_digits(digits) || (digits.size() > 1 && digits.front() == '0')) return none;
+
+		return unsigned(std::stoul(digits));
+	}
+}
+
 optional<Step> step_by_desc(Graph const & g, string const & desc, optional<NodeNum> const from)
 {
-	foreach(sn : seqnums(g))
-		if (replace_all(g[sn].description.front(), "\\n", " ") == desc
-			|| desc == "t" + std::to_string(sn.index))
+	auto const step = [&](SeqNum const sn) -> optional<Step>
 		{
 			if (!from || g.from(sn).node == *from)
 				return Step{sn, false};
-			if (is_bidirectional(g[sn]) && g.to(sn).node == *from)
+			if (is_bidirectional(g, sn) && g.to(sn).node == *from)
 				return Step{sn, true};
-		}
+			return none;
+		};
 
-	return none;
+	optional<Step> r;
+
+	foreach(sn : g.sequences_described(desc))
+		if ((r = step(sn))) break;
+
+	if (optional<unsigned> const t = numbered('t', desc))
+		if (*t < g.num_sequences() && (!r || *t < r->seq.index))
+			if (auto const s = step(SeqNum{uint16_t(*t)}))
+				r = s;
+
+	return r;
 }
 
 optional<NodeNum> node_by_desc(Graph const & g, string const & desc)
@@ -49,14 +74,9 @@ optional<NodeNum> node_by_desc(Graph const & g, string const & desc)
 	if (desc.size() >= 2 && desc.front() == 'p' && all_digits(desc.substr(1)))
 		return NodeNum{uint16_t(std::stoul(desc.substr(1)))};
 
-	foreach(n : nodenums(g))
-	{
-		auto const & d = g[n].description;
-		if (!d.empty() && replace_all(d.front(), "\\n", " ") == desc)
-			return n;
-	}
-
-	return none;
+	auto const & v = g.nodes_described(desc);
+	if (v.empty()) return none;
+	return v.front();
 }
 
 optional<PositionInSequence> posinseq_by_desc(Graph const & g, string const & s)
@@ -72,9 +92,11 @@ optional<PositionInSequence> posinseq_by_desc(Graph const & g, string const & s)
 
 optional<PositionInSequence> node_as_posinseq(Graph const & g, NodeNum const node)
 {
-	foreach(sn : seqnums(g))
-		if (g.from(sn).node == node) return first_pos_in(sn);
-		else if (g.to(sn).node == node) return last_pos_in(g, sn);
+	auto const & o = g.out(node);
+	auto const & i = g.in(node);
+
+	if (!o.empty() && (i.empty() || !(i.front() < o.front()))) return first_pos_in(o.front());
+	if (!i.empty()) return last_pos_in(g, i.front());
 
 	return none;
 }
@@ -231,33 +253,51 @@ set<string> tags_in_desc(vector<string> const & desc)
 	return r;
 }
 
+TagMask mask(Graph const & g, TagQuery const & q)
+{
+	TagMask m{TagSet(g.tag_dictionary().size()), TagSet(g.tag_dictionary().size()), true};
+
+	foreach (e : q)
+		if (auto const t = g.tag_dictionary().find(e.first))
+			(e.second ? m.include : m.exclude).set(*t);
+		else if (e.second)
+			m.satisfiable = false;
+
+	return m;
+}
+
 TagQuery query_for(Graph const & g, NodeNum const n)
 {
-	TagQuery q;
+	Dictionary const & d = g.tag_dictionary();
+
+	TagMask m{g.tags(n), TagSet(d.size()), true};
 
-	foreach (t : tags(g[n]))
+	TagQuery q;
+	foreach (t : tags(g, n))
 		q.insert(make_pair(t, true));
 
 	while (q.size() < 10)
 	{
-		map<string, int> c;
+		vector<int> c(d.size(), 0);
 
-		foreach (m : match(g, q))
-			if (m != n)
-				foreach (t : tags(g[m]))
-					if (q.find(make_pair(t, true)) == q.end()
-						&& q.find(make_pair(t, false)) == q.end())
-						++c[t];
+		foreach (o : nodenums(g))
+			if (o != n && m(g.tags(o)))
+			{
+				TagSet const t = g.tags(o) - m.include - m.exclude;
+				for (auto i = t.find_first(); i != TagSet::npos; i = t.find_next(i))
+					++c[i];
+			}
 
-		if (c.empty()) break;
+		optional<unsigned> best;
+		for (unsigned i = 0; i != c.size(); ++i)
+			if (c[i] != 0 && (!best || c[i] > c[*best] || (c[i] == c[*best] && d[i] < d[*best])))
+				best = i;
+					// ties go to the alphabetically first tag
 
-		auto me = std::max_element(c.begin(), c.end(),
-			[](pair<string, int> const & x, pair<string, int> const & y)
-			{
-				return x.second < y.second;
-			});
+		if (!best) break;
 
-		q.insert(make_pair(me->first, false));
+		m.exclude.set(*best);
+		q.insert(make_pair(d[*best], false));
 	}
 
 	return q;
@@ -284,105 +324,252 @@ set<string> properties_in_desc(vector<string> const & desc)
 
 set<string> tags(Graph const & g)
 {
-	set<string> r;
+	TagSet all(g.tag_dictionary().size());
 
-	foreach(n : nodenums(g)) foreach(t : tags(g[n])) r.insert(t);
-	foreach(s : seqnums(g)) foreach(t : tags(g[s])) r.insert(t);
+	foreach(n : nodenums(g)) all |= g.tags(n);
+	foreach(s : seqnums(g)) all |= g.tags(s);
 
-	return r;
+	return names(g.tag_dictionary(), all);
 }
 
-bool connected(Graph const & g, NodeNum const a, set<NodeNum> const & s)
+bool connected(Graph const & g, NodeNum const a, NodeNum const b)
 {
-	foreach(b : s)
-		if (connected(g, a, b)) return true;
+	foreach(s : g.out(a)) if (g.to(s).node == b) return true;
+	foreach(s : g.in(a)) if (g.from(s).node == b) return true;
 
 	return false;
 }
 
-bool connected(Graph const & g, NodeNum const a, NodeNum const b)
+PathCost path_cost(string const & name)
 {
-	foreach(s : seqnums(g))
-		if ((g.from(s).node == a && g.to(s).node == b) ||
-		    (g.to(s).node == a && g.from(s).node == b))
-			return true;
+	if (name == "transitions") return PathCost::Transitions;
+	if (name == "frames") return PathCost::Frames;
 
-	return false;
+	throw runtime_error("unknown path cost: " + name);
 }
 
-std::set<NodeNum> grow(Graph const & g, std::set<NodeNum> const & nodes)
+namespace
 {
-	auto r = nodes;
+	class Dijkstra
+		// one direction of a bidirectional search
+	{
+		using Entry = pair<unsigned, NodeNum>;
 
-	foreach(n : nodenums(g))
-		if (connected(g, n, nodes)) { r.insert(n); break; }
+		static bool later(Entry const & a, Entry const & b) { return a.first > b.first; }
 
-	return r;
+		std::priority_queue<Entry, vector<Entry>, bool(*)(Entry const &, Entry const &)> queue{later};
+
+	public:
+
+		static unsigned const unreached = ~0u;
+
+		vector<unsigned> cost;
+		vector<optional<Step>> via; // the step into the node (forward) or out of it (backward)
+
+		Dijkstra(Graph const & g, NodeNum const start)
+			: cost(g.num_nodes(), unreached)
+			, via(g.num_nodes())
+		{
+			cost[start.index] = 0;
+			queue.emplace(0, start);
+		}
+
+		optional<unsigned> front_cost()
+		{
+			while (!queue.empty() && queue.top().first != cost[queue.top().second.index]) queue.pop();
+				// stale entries
+			if (queue.empty()) return none;
+			return queue.top().first;
+		}
+
+		template<typename F>
+		void expand(F const & relax)
+			// calls relax(node, cost) for the cheapest unexpanded node
+		{
+			Entry const e = queue.top();
+			queue.pop();
+			relax(e.second, e.first);
+		}
+
+		bool improve(NodeNum const n, unsigned const c, Step const s)
+		{
+			if (c >= cost[n.index]) return false;
+
+			cost[n.index] = c;
+			via[n.index] = s;
+			queue.emplace(c, n);
+			return true;
+		}
+	};
+
+	unsigned const Dijkstra::unreached;
 }
 
-std::set<NodeNum> grow(Graph const & g, std::set<NodeNum> nodes, unsigned const depth)
+optional<Path> cheapest_path(Graph const & g, NodeNum const from, NodeNum const to, PathCost const pc)
 {
-	for (unsigned d = 0; d != depth; ++d) nodes = grow(g, nodes);
-	return nodes;
+	auto const step_cost = [&](Step const s)
+		{
+			return pc == PathCost::Transitions ? 1u : unsigned(g[s.seq].positions.size() - 1);
+		};
+
+	Dijkstra fwd(g, from), bwd(g, to);
+
+	unsigned best = from == to ? 0 : Dijkstra::unreached;
+	NodeNum meet = from;
+
+	auto const met = [&](NodeNum const n)
+		{
+			if (fwd.cost[n.index] == Dijkstra::unreached || bwd.cost[n.index] == Dijkstra::unreached) return;
+
+			unsigned const c = fwd.cost[n.index] + bwd.cost[n.index];
+			if (c < best) { best = c; meet = n; }
+		};
+
+	for (;;)
+	{
+		optional<unsigned> const f = fwd.front_cost(), b = bwd.front_cost();
+
+		if (!f || !b || (best != Dijkstra::unreached && *f + *b >= best)) break;
+			// any path through an unexpanded node would cost at least that much
+
+		if (*f <= *b)
+			fwd.expand([&](NodeNum const n, unsigned const c)
+				{
+					foreach (s : out_steps(g, n))
+						if (fwd.improve(GrappleMap::to(g, s).node, c + step_cost(s), s))
+							met(GrappleMap::to(g, s).node);
+				});
+		else
+			bwd.expand([&](NodeNum const n, unsigned const c)
+				{
+					foreach (s : in_steps(g, n))
+						if (bwd.improve(GrappleMap::from(g, s).node, c + step_cost(s), s))
+							met(GrappleMap::from(g, s).node);
+				});
+	}
+
+	if (best == Dijkstra::unreached) return none;
+
+	Path r;
+
+	for (NodeNum n = meet; n != from; n = GrappleMap::from(g, *fwd.via[n.index]).node)
+		r.push_back(*fwd.via[n.index]);
+
+	std::reverse(r.begin(), r.end());
+
+	for (NodeNum n = meet; n != to; n = GrappleMap::to(g, *bwd.via[n.index]).node)
+		r.push_back(*bwd.via[n.index]);
+
+	return r;
 }
 
 set<NodeNum> nodes_around(Graph const & g, set<NodeNum> const & nodes, unsigned depth)
 {
-	set<NodeNum> all = nodes;
+	vector<bool> seen(g.num_nodes());
+	vector<NodeNum> frontier(nodes.begin(), nodes.end()), next;
 	set<NodeNum> r;
 
-	for (unsigned d = 0; d != depth; ++d)
+	foreach(n : nodes) seen[n.index] = true;
+
+	auto const visit = [&](NodeNum const n)
+		{
+			if (seen[n.index]) return;
+			seen[n.index] = true;
+			r.insert(n);
+			next.push_back(n);
+		};
+
+	for (unsigned d = 0; d != depth && !frontier.empty(); ++d)
 	{
-		set<NodeNum> const prev = all;
+		next.clear();
 
-		foreach(n : nodenums(g))
-			if (connected(g, n, prev) && all.count(n) == 0)
-			{
-				all.insert(n);
-				r.insert(n);
-			}
+		foreach(n : frontier)
+		{
+			foreach(s : g.out(n)) visit(g.to(s).node);
+			foreach(s : g.in(n)) visit(g.from(s).node);
+		}
+
+		frontier.swap(next);
 	}
 
 	return r;
 }
 
-vector<Path> in_paths(Graph const & g, NodeNum const node, unsigned size)
+std::set<NodeNum> grow(Graph const & g, std::set<NodeNum> nodes, unsigned const depth)
 {
-	if (size == 0) return {Path()};
+	foreach(n : nodes_around(g, nodes, depth)) nodes.insert(n);
+	return nodes;
+}
 
-	auto const is = in_steps(g, node);
+namespace
+{
+	bool in_paths(Graph const & g, NodeNum const node, unsigned const size,
+		Path & reversed, Path & path, PathCallback const & f)
+	{
+		auto const & is = in_steps(g, node);
 
-	if (is.empty()) return {Path()};
+		if (size == 0 || is.empty())
+		{
+			path.assign(reversed.rbegin(), reversed.rend());
+			return f(path);
+		}
 
-	vector<Path> r;
+		foreach (x : is)
+		{
+			reversed.push_back(x);
+			bool const more = in_paths(g, from(g, x).node, size - 1, reversed, path, f);
+			reversed.pop_back();
+			if (!more) return false;
+		}
+
+		return true;
+	}
 
-	foreach (x : is)
-		foreach (e : in_paths(g, from(g, x).node, size - 1))
+	bool out_paths(Graph const & g, NodeNum const node, unsigned const size,
+		Path & path, PathCallback const & f)
+	{
+		auto const & os = out_steps(g, node);
+
+		if (size == 0 || os.empty()) return f(path);
+
+		foreach (x : os)
 		{
-			e.push_back(x);
-			r.push_back(e);
+			path.push_back(x);
+			bool const more = out_paths(g, to(g, x).node, size - 1, path, f);
+			path.pop_back();
+			if (!more) return false;
 		}
 
-	return r;
+		return true;
+	}
 }
 
-vector<Path> out_paths(Graph const & g, NodeNum const node, unsigned size)
+bool foreach_in_path(Graph const & g, NodeNum const node, unsigned const size, PathCallback const & f)
 {
-	if (size == 0) return {Path()};
-
-	auto const os = out_steps(g, node);
+	Path reversed, path;
+	reversed.reserve(size);
+	path.reserve(size);
+	return in_paths(g, node, size, reversed, path, f);
+}
 
-	if (os.empty()) return {Path()};
+bool foreach_out_path(Graph const & g, NodeNum const node, unsigned const size, PathCallback const & f)
+{
+	Path path;
+	path.reserve(size);
+	return out_paths(g, node, size, path, f);
+}
 
+vector<Path> in_paths(Graph const & g, NodeNum const node, unsigned const size)
+{
 	vector<Path> r;
+	foreach_in_path(g, node, size, [&](Path const & p) { r.push_back(p); return true; });
+	return r;
+}
 
-	foreach (x : os)
-		foreach (e : out_paths(g, to(g, x).node, size - 1))
-		{
-			e.insert(e.begin(), x);
-			r.push_back(e);
-		}
-
+vector<Path> out_paths(Graph const & g, NodeNum const node, unsigned const size)
+{
+	vector<Path> r;
+	foreach_out_path(g, node, size, [&](Path const & p) { r.push_back(p); return true; });
 	return r;
 }
 
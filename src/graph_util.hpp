@@ -3,6 +3,7 @@
 
 #include "graph.hpp"
 #include <map>
+#include <functional>
 #include <boost/range/counting_range.hpp>
 #include <boost/range/adaptor/filtered.hpp>
 
@@ -14,8 +15,6 @@ using SeqNumIter = boost::counting_iterator<SeqNum, std::forward_iterator_tag, i
 using NodeNumRange = boost::iterator_range<NodeNumIter>;
 using SeqNumRange = boost::iterator_range<SeqNumIter>;
 
-struct Step { SeqNum seq; bool reverse; };
-
 using Path = vector<Step>;
 
 inline NodeNumRange nodenums(Graph const & g) { return {NodeNum{0}, NodeNum{g.num_nodes()}}; }
@@ -56,36 +55,14 @@ inline map<NodeNum, std::pair<
 	return m;
 }
 
-inline vector<SeqNum> in(Graph const & g, NodeNum const n)
-{
-	vector<SeqNum> v;
-
-	foreach(sn : seqnums(g))
-		if (g.to(sn).node == n)
-			v.push_back(sn);
-
-	return v;
-}
-
-inline vector<SeqNum> out(Graph const & g, NodeNum const n)
-{
-	vector<SeqNum> v;
-
-	foreach(sn : seqnums(g))
-		if (g.from(sn).node == n)
-			v.push_back(sn);
-
-	return v;
-}
-
-inline bool operator==(Step const a, Step const b)
+inline vector<SeqNum> const & in(Graph const & g, NodeNum const n)
 {
-	return a.seq == b.seq && a.reverse == b.reverse;
+	return g.in(n);
 }
 
-inline bool operator<(Step const a, Step const b)
+inline vector<SeqNum> const & out(Graph const & g, NodeNum const n)
 {
-	return std::tie(a.seq, a.reverse) < std::tie(b.seq, b.reverse);
+	return g.out(n);
 }
 
 inline ReorientedNode const & from(Graph const & g, Step const s)
@@ -158,75 +135,127 @@ inline set<string> tags(Sequence const & s)
 	return tags_in_desc(s.description);
 }
 
+inline set<string> names(Dictionary const & d, TagSet const & s)
+{
+	set<string> r;
+	for (auto i = s.find_first(); i != TagSet::npos; i = s.find_next(i)) r.insert(d[i]);
+	return r;
+}
+
+inline set<string> tags(Graph const & g, NodeNum const n)
+{
+	return names(g.tag_dictionary(), g.tags(n));
+}
+
+inline set<string> tags(Graph const & g, SeqNum const s)
+{
+	return names(g.tag_dictionary(), g.tags(s));
+}
+
 inline set<string> properties(Graph const & g, SeqNum const s)
 {
-	return properties_in_desc(g[s].description);
+	return names(g.property_dictionary(), g.properties(s));
+}
+
+inline bool has_property(Graph const & g, SeqNum const s, string const & prop)
+{
+	optional<unsigned> const p = g.property_dictionary().find(prop);
+	return p && g.properties(s).test(*p);
+}
+
+inline bool is_bidirectional(Graph const & g, SeqNum const s)
+{
+	return has_property(g, s, "bidirectional");
+}
+
+inline bool is_detailed(Graph const & g, SeqNum const s)
+{
+	return has_property(g, s, "detailed");
 }
 
-inline bool is_bidirectional(Sequence const & s)
+inline bool is_top_move(Graph const & g, SeqNum const s)
 {
-	return properties_in_desc(s.description).count("bidirectional") != 0;
+	return has_property(g, s, "top");
 }
 
-inline bool is_detailed(Sequence const & s)
+inline bool is_bottom_move(Graph const & g, SeqNum const s)
 {
-	return properties_in_desc(s.description).count("detailed") != 0;
+	return has_property(g, s, "bottom");
 }
 
-inline bool is_top_move(Sequence const & s)
+inline bool is_tagged(Graph const & g, optional<unsigned> const tag, NodeNum const n)
 {
-	return properties_in_desc(s.description).count("top") != 0;
+	return tag && g.tags(n).test(*tag);
 }
 
-inline bool is_bottom_move(Sequence const & s)
+inline bool is_tagged(Graph const & g, optional<unsigned> const tag, SeqNum const sn)
 {
-	return properties_in_desc(s.description).count("bottom") != 0;
+	return tag && (g.tags(sn).test(*tag)
+		|| (g.tags(g.from(sn).node).test(*tag)
+		&& g.tags(g.to(sn).node).test(*tag)));
 }
 
 inline bool is_tagged(Graph const & g, string const & tag, NodeNum const n)
 {
-	return tags(g[n]).count(tag) != 0;
+	return is_tagged(g, g.tag_dictionary().find(tag), n);
 }
 
 inline bool is_tagged(Graph const & g, string const & tag, SeqNum const sn)
 {
-	return tags(g[sn]).count(tag) != 0
-		|| (is_tagged(g, tag, g.from(sn).node)
-		&& is_tagged(g, tag, g.to(sn).node));
+	return is_tagged(g, g.tag_dictionary().find(tag), sn);
 }
 
 inline auto tagged_nodes(Graph const & g, string const & tag)
 {
+	optional<unsigned> const t = g.tag_dictionary().find(tag);
+
 	return nodenums(g) | boost::adaptors::filtered(
-		[&](NodeNum n){ return is_tagged(g, tag, n); });
+		[&g, t](NodeNum n){ return is_tagged(g, t, n); });
 }
 
 inline auto tagged_sequences(Graph const & g, string const & tag)
 {
+	optional<unsigned> const t = g.tag_dictionary().find(tag);
+
 	return seqnums(g) | boost::adaptors::filtered(
-		[&](SeqNum n){ return is_tagged(g, tag, n); });
+		[&g, t](SeqNum n){ return is_tagged(g, t, n); });
 }
 
 using TagQuery = set<pair<string /* tag */, bool /* include/exclude */>>;
 
+struct TagMask
+{
+	TagSet include, exclude;
+	bool satisfiable;
+
+	bool operator()(TagSet const & s) const
+	{
+		return satisfiable && include.is_subset_of(s) && !exclude.intersects(s);
+	}
+};
+
+TagMask mask(Graph const &, TagQuery const &);
+
 inline auto match(Graph const & g, TagQuery const & q)
 {
 	return nodenums(g) | boost::adaptors::filtered(
-		[&](NodeNum n){
-			foreach (e : q)
-			{
-				if (is_tagged(g, e.first, n) != e.second)
-					return false;
-			}
-			return true;
-			});
+		[&g, m = mask(g, q)](NodeNum n){ return m(g.tags(n)); });
 }
 
 TagQuery query_for(Graph const &, NodeNum);
 
+enum class PathCost { Transitions, Frames };
+
+PathCost path_cost(string const & name); // "transitions" or "frames"
+
+optional<Path> cheapest_path(Graph const &, NodeNum from, NodeNum to, PathCost);
+	// by bidirectional Dijkstra, following bidirectional sequences both ways
+
 set<NodeNum> nodes_around(Graph const &, set<NodeNum> const &, unsigned depth = 1);
+	// the nodes at most depth transitions away from the given ones (in either direction), excluding those
 
 set<NodeNum> grow(Graph const &, set<NodeNum>, unsigned depth);
+	// the given nodes plus nodes_around them
 
 optional<SeqNum> seq_by_arg(Graph const &, string const & arg);
 optional<NodeNum> node_by_arg(Graph const &, string const & arg);
@@ -236,37 +265,24 @@ inline bool is_sweep(Graph const & g, SeqNum const s)
 	return g.from(s).reorientation.swap_players != g.to(s).reorientation.swap_players;
 }
 
-inline vector<Step> out_steps(Graph const & g, NodeNum const n)
+inline vector<Step> const & out_steps(Graph const & g, NodeNum const n)
 {
-	vector<Step> v;
-
-	foreach(sn : seqnums(g))
-	{
-		if (g.from(sn).node == n)
-			v.push_back({sn, false});
-
-		if (is_bidirectional(g[sn]) && g.to(sn).node == n)
-			v.push_back({sn, true});
-	}
-
-	return v;
+	return g.out_steps(n);
 }
 
-inline vector<Step> in_steps(Graph const & g, NodeNum const n)
+inline vector<Step> const & in_steps(Graph const & g, NodeNum const n)
 {
-	vector<Step> v;
+	return g.in_steps(n);
+}
 
-	foreach(sn : seqnums(g))
-	{
-		if (g.to(sn).node == n)
-			v.push_back({sn, false});
+using PathCallback = std::function<bool(Path const &)>;
+	// return false to stop the enumeration
 
-		if (is_bidirectional(g[sn]) && g.from(sn).node == n)
-			v.push_back({sn, true});
-	}
-
-	return v;
-}
+bool foreach_in_path(Graph const &, NodeNum, unsigned size, PathCallback const &);
+	// calls back with each possible path of given size that ends at given node,
+	// reusing one Path; returns false if the callback stopped it
+bool foreach_out_path(Graph const &, NodeNum, unsigned size, PathCallback const &);
+	// same for the paths that start at given node
 
 vector<Path> in_paths(Graph const &, NodeNum, unsigned size);
 	// returns all possible paths of given size that end at given node
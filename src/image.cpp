@@ -0,0 +1,174 @@
+#include "image.hpp"
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+namespace GrappleMap {
+
+namespace
+{
+	RGB box(RGBA const * p, size_t const stride, unsigned const factor)
+	{
+		unsigned r = 0, g = 0, b = 0;
+
+		for (unsigned dy = 0; dy != factor; ++dy, p += stride)
+		for (unsigned dx = 0; dx != factor; ++dx)
+		{
+			r += p[dx].r;
+			g += p[dx].g;
+			b += p[dx].b;
+		}
+
+		unsigned const n = factor * factor;
+
+		return RGB{uint8_t(b / n), uint8_t(g / n), uint8_t(r / n)};
+	}
+
+	#ifdef __SSE2__
+
+	// Channels are summed in 16 bit lanes, four per pixel. Results are truncated
+	// like box()'s, so both paths give identical images.
+
+	__m128i load(RGBA const * const p) { return _mm_loadu_si128(reinterpret_cast<__m128i const *>(p)); }
+
+	void store(RGB * const out, __m128i const packed, unsigned const n)
+	{
+		alignas(16) uint8_t b[16];
+		_mm_store_si128(reinterpret_cast<__m128i *>(b), packed);
+
+		for (unsigned i = 0; i != n; ++i)
+			out[i] = RGB{b[i * 4 + 2], b[i * 4 + 1], b[i * 4]};
+	}
+
+	__m128i pairs2(RGBA const * const p, size_t const stride)
+		// the sums of pixels 0-1 and 2-3 over two rows
+	{
+		__m128i const
+			zero = _mm_setzero_si128(),
+			a = load(p), b = load(p + stride),
+			lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+			hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+		return _mm_srli_epi16(
+			_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi)), 2);
+	}
+
+	unsigned row2(RGBA const * const in, size_t const stride, RGB * const out, unsigned const width)
+	{
+		unsigned x = 0;
+
+		for (; x + 4 <= width; x += 4)
+			store(out + x, _mm_packus_epi16(pairs2(in + x * 2, stride), pairs2(in + x * 2 + 4, stride)), 4);
+
+		return x;
+	}
+
+	__m128i quad4(RGBA const * p, size_t const stride)
+		// the sum of a 4x4 block in the low four lanes
+	{
+		__m128i const zero = _mm_setzero_si128();
+		__m128i s = zero;
+
+		for (int i = 0; i != 4; ++i, p += stride)
+		{
+			__m128i const a = load(p);
+			s = _mm_add_epi16(s, _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero)));
+		}
+
+		return _mm_srli_epi16(_mm_add_epi16(s, _mm_srli_si128(s, 8)), 4);
+	}
+
+	unsigned row4(RGBA const * const in, size_t const stride, RGB * const out, unsigned const width)
+	{
+		unsigned x = 0;
+
+		for (; x + 2 <= width; x += 2)
+		{
+			__m128i const s = _mm_unpacklo_epi64(quad4(in + x * 4, stride), quad4(in + x * 4 + 4, stride));
+			store(out + x, _mm_packus_epi16(s, s), 2);
+		}
+
+		return x;
+	}
+
+	#endif
+}
+
+void Accumulator::add(RGBA const * const frame, size_t const pixels)
+{
+	static_assert(sizeof(RGBA) == 4, "RGBA must be packed");
+
+	if (count == 257) error("accumulated too many frames");
+
+	if (count == 0) sums.assign(pixels * 4, 0);
+	else if (sums.size() != pixels * 4) error("accumulated frames differ in size");
+
+	uint8_t const * const in = &frame->r;
+	uint16_t * const s = sums.data();
+
+	size_t i = 0;
+
+	#ifdef __SSE2__
+		__m128i const zero = _mm_setzero_si128();
+
+		for (; i + 16 <= pixels * 4; i += 16)
+		{
+			__m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(in + i));
+			__m128i * const lo = reinterpret_cast<__m128i *>(s + i);
+			__m128i * const hi = reinterpret_cast<__m128i *>(s + i + 8);
+
+			_mm_storeu_si128(lo, _mm_add_epi16(_mm_loadu_si128(lo), _mm_unpacklo_epi8(v, zero)));
+			_mm_storeu_si128(hi, _mm_add_epi16(_mm_loadu_si128(hi), _mm_unpackhi_epi8(v, zero)));
+		}
+	#endif
+
+	for (; i != pixels * 4; ++i) s[i] += in[i];
+
+	++count;
+}
+
+RGBA const * Accumulator::average()
+{
+	if (count == 0) error("nothing accumulated");
+
+	if (quotients.size() != count * 255 + 1)
+	{
+		quotients.resize(count * 255 + 1);
+		for (unsigned v = 0; v != quotients.size(); ++v)
+			quotients[v] = (v + count / 2) / count;
+	}
+
+	result.resize(sums.size() / 4);
+
+	uint8_t * const out = &result.front().r;
+	for (size_t i = 0; i != sums.size(); ++i) out[i] = quotients[sums[i]];
+
+	return result.data();
+}
+
+Image downsample(RGBA const * const framebuffer, unsigned const width, unsigned const height, unsigned const factor)
+{
+	Image r(width, height);
+
+	size_t const stride = size_t(width) * factor;
+
+	for (unsigned y = 0; y != height; ++y)
+	{
+		RGBA const * const in = framebuffer + y * factor * stride;
+		RGB * const out = &r.pixels[size_t(height - 1 - y) * width];
+
+		unsigned x = 0;
+
+		#ifdef __SSE2__
+			if (factor == 2) x = row2(in, stride, out, width);
+			else if (factor == 4) x = row4(in, stride, out, width);
+		#endif
+
+		for (; x != width; ++x) out[x] = box(in + x * factor, stride, factor);
+	}
+
+	return r;
+}
+
+}
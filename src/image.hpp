@@ -0,0 +1,50 @@
+#ifndef GRAPPLEMAP_IMAGE_HPP
+#define GRAPPLEMAP_IMAGE_HPP
+
+#include "util.hpp"
+#include <cstdint>
+
+namespace GrappleMap {
+
+struct RGB { uint8_t r, g, b; };
+struct RGBA { uint8_t r, g, b, a; };
+
+inline bool operator==(RGB const a, RGB const b) { return a.r == b.r && a.g == b.g && a.b == b.b; }
+inline bool operator!=(RGB const a, RGB const b) { return !(a == b); }
+
+struct Image
+{
+	unsigned width = 0, height = 0;
+	vector<RGB> pixels; // row by row, top row first
+
+	Image() = default;
+	Image(unsigned const w, unsigned const h): width(w), height(h), pixels(w * h) {}
+
+	RGB & operator()(unsigned const x, unsigned const y) { return pixels[y * width + x]; }
+	RGB const & operator()(unsigned const x, unsigned const y) const { return pixels[y * width + x]; }
+};
+
+Image downsample(RGBA const * framebuffer, unsigned width, unsigned height, unsigned factor);
+	// Box-filters a framebuffer of factor times the width and height, bottom row first as
+	// OpenGL leaves it. Red and blue trade places, as the renderer's colors are BGR.
+	// Factors 2 and 4 are vectorized where SSE2 is available.
+
+class Accumulator
+	// Averages framebuffers, for motion blur. Sums are 16 bits per channel, so at
+	// most 257 frames can be added between resets.
+{
+	vector<uint16_t> sums; // four per pixel
+	unsigned count = 0;
+	vector<uint8_t> quotients; // sum / count, rounded, by sum
+	vector<RGBA> result;
+
+public:
+
+	void add(RGBA const *, size_t pixels);
+	RGBA const * average(); // valid until the next call
+	void reset() { count = 0; }
+};
+
+}
+
+#endif
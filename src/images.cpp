@@ -1,55 +1,20 @@
-#include "png.h"
 #include "images.hpp"
+#include "gif.hpp"
+#include "png.hpp"
+#include "parallel.hpp"
 #include "camera.hpp"
 #include "rendering.hpp"
 #include <boost/program_options.hpp>
 #include <unistd.h>
 
-namespace GrappleMap
-{
-	inline std::size_t hash_value(V3 const v) // todo: put elsewhere
-	{
-		size_t seed = 0;
-		boost::hash_combine(seed, v.x);
-		boost::hash_combine(seed, v.y);
-		boost::hash_combine(seed, v.z);
-		return seed;
-	}
-}
-
-#include <boost/functional/hash.hpp>
-
-#ifndef int_p_NULL // ffs
-	#define int_p_NULL (int*)NULL // https://github.com/ignf/gilviewer/issues/8
-#endif
-
-#include <boost/gil/extension/io/png_io.hpp>
-#include <boost/gil/gil_all.hpp>
 #include <boost/filesystem.hpp>
+#include <chrono>
+#include <memory>
 
 namespace GrappleMap {
 
 namespace
 {
-	void make_gif(
-		string const output_dir,
-		string const filename,
-		unsigned const delay,
-		std::function<vector<string>(string)> make_frames)
-	{
-		if (!boost::filesystem::exists(output_dir + "/" + filename))
-		{
-			string const gif_frames_dir = output_dir + "/gifframes/";
-
-			string command = "convert -depth 8 -delay " + to_string(delay) + " -loop 0 ";
-			foreach (f : make_frames(gif_frames_dir)) command += gif_frames_dir + f + ' ';
-			command += output_dir + "/" + filename;
-
-			if (std::system(command.c_str()) != 0)
-				throw std::runtime_error("command failed: " + command);
-		}
-	}
-
 	vector<double> smoothen_v(vector<double> const & v)
 	{
 		vector<double> r;
@@ -67,22 +32,132 @@ namespace
 
 		return r;
 	}
+
+	Camera turned(double const angle, double const ymax)
+	{
+		Camera camera;
+		camera.hardSetOffset({0, ymax - 0.57, 0});
+		camera.zoom(0.55);
+		camera.rotateHorizontal(angle);
+		camera.rotateVertical((ymax - 0.6)/2);
+		return camera;
+	}
+
+	vector<View> window(ImageView const view)
+	{
+		if (view.heading) return {{0, 0, 1, 1, none, 45}};
+		if (!view.player) abort();
+		return {{0, 0, 1, 1, *view.player, 80}};
+	}
+
+	class Animation
+		// What the views of an animation have in common, worked out when the first
+		// of them is rendered. Only used by one thread at a time.
+	{
+		vector<Position> const frames;
+		vector<Position> mirrored;
+		vector<double> ymaxes;
+		map<Heading, vector<Camera>> cameras;
+		map<PlayerNum, vector<Camera>> player_cameras;
+		bool ready = false;
+
+		void prepare()
+		{
+			foreach (pos : frames)
+			{
+				mirrored.push_back(mirror(pos));
+				ymaxes.push_back(std::max(.8, std::max(pos[0][Head].y, pos[1][Head].y)));
+			}
+
+			for (int i = 0; i != 10; ++i)
+				ymaxes = smoothen_v(ymaxes);
+
+			ready = true;
+		}
+
+		vector<Camera> & cameras_for(ImageView const view)
+		{
+			vector<Camera> & c = view.heading ? cameras[*view.heading] : player_cameras[*view.player];
+
+			if (c.empty())
+				foreach (y : ymaxes) c.push_back(ImageMaker::camera(view, y));
+
+			return c;
+		}
+
+	public:
+
+		explicit Animation(vector<Position> f): frames(move(f)) {}
+
+		vector<Position> const & positions() const { return frames; }
+
+		vector<Image> images(ImageMaker const & mkimg, ImageView const view,
+			unsigned const width, unsigned const height, V3 const bg_color)
+		{
+			if (!ready) prepare();
+
+			vector<Position> const & v = view.mirror ? mirrored : frames;
+			vector<Camera> const & c = cameras_for(view);
+
+			vector<Image> r;
+			r.reserve(v.size());
+
+			for (size_t i = 0; i != v.size(); ++i)
+				r.push_back(mkimg.image(v[i], c[i], view, width, height, bg_color));
+
+			return r;
+		}
+	};
+
+	template <typename T>
+	string bytes(T const & x)
+	{
+		return string(reinterpret_cast<char const *>(&x), sizeof x);
+	}
+
+	string digest(vector<Position> const & frames, string const & attrs)
+		// of everything an image shows, which is also what the file is named after
+	{
+		return md5(string(reinterpret_cast<char const *>(frames.data()), frames.size() * sizeof(Position)) + attrs);
+	}
+
+	void link(string const & output_dir, string const & filename, string const & linkname)
+	{
+		string const path = output_dir + "/" + linkname;
+
+		unlink(path.c_str());
+		if (symlink(filename.c_str(), path.c_str()))
+			perror("symlink");
+	}
 }
 
-void ImageMaker::png(
-	Position pos,
+RGBA * ImageMaker::bind(unsigned const width, unsigned const height) const
+{
+	if (framebuffer.size() != size_t(width) * height
+		|| framebuffer_width != width
+		|| OSMesaGetCurrentContext() != ctx)
+	{
+		framebuffer.resize(size_t(width) * height);
+		framebuffer_width = width;
+
+		if (!OSMesaMakeCurrent(ctx, framebuffer.data(), GL_UNSIGNED_BYTE, width, height))
+			error("OSMesaMakeCurrent");
+	}
+
+	return framebuffer.data();
+}
+
+Image ImageMaker::image(
+	Position const & pos,
 	Camera const & camera,
 	unsigned const width, unsigned const height,
-	string const path, V3 const bg_color,
+	V3 const bg_color,
 	vector<View> const & view,
 	unsigned const grid_size, unsigned const grid_line_width) const
 {
-	if (boost::filesystem::exists(path)) return;
+	unsigned const ss = supersampling;
 
-	vector<boost::gil::rgb8_pixel_t> buf(width*2 * height*2);
-
-	if (!OSMesaMakeCurrent(ctx, buf.data(), GL_UNSIGNED_BYTE, width*2, height*2))
-		error("OSMesaMakeCurrent");
+	RGBA const * const buf = bind(width*ss, height*ss);
 
 	Style style;
 	style.grid_size = grid_size;
@@ -90,64 +165,49 @@ void ImageMaker::png(
 	style.grid_color = bg_color * .8;
 	style.background_color = bg_color;
 
+	auto const start = std::chrono::steady_clock::now();
+
 	renderWindow(
 		view,
 		nullptr, // no viables
 		graph, pos, camera,
 		none, // no highlighted joint
 		false, // not edit mode
-		0, 0, width*2, height*2,
+		0, 0, width*ss, height*ss,
 		{0},
 		style);
 
+	auto const rendered = std::chrono::steady_clock::now();
+
 	glFlush();
 	glFinish();
 
-	foreach (p : buf) std::swap(p[0], p[2]);
+	auto const finished = std::chrono::steady_clock::now();
 
-	vector<boost::gil::rgb8_pixel_t> buf2(width * height);
+	Image r = downsample(buf, width, height, ss);
 
-	auto xy = [&](unsigned x, unsigned y){ return buf[y*width*2+x]; };
-
-	for (unsigned x = 0; x != width; ++x)
-	for (unsigned y = 0; y != height; ++y)
+	if (times)
 	{
-		auto const & a = xy(x*2,  y*2  );
-		auto const & b = xy(x*2+1,y*2  );
-		auto const & c = xy(x*2,  y*2+1);
-		auto const & d = xy(x*2+1,y*2+1);
-
-		buf2[y*width+x][0] = (a[0] + b[0] + c[0] + d[0]) / 4;
-		buf2[y*width+x][1] = (a[1] + b[1] + c[1] + d[1]) / 4;
-		buf2[y*width+x][2] = (a[2] + b[2] + c[2] + d[2]) / 4;
+		using seconds = std::chrono::duration<double>;
+		times->render += seconds(rendered - start).count();
+		times->readback += seconds(finished - rendered).count();
+		times->downsample += seconds(std::chrono::steady_clock::now() - finished).count();
 	}
-		// todo: clean up
 
-	try
-	{
-		boost::gil::png_write_view(path,
-			boost::gil::flipped_up_down_view(boost::gil::interleaved_view(width, height, buf2.data(), width*3)));
-	}
-	catch (std::ios_base::failure const &)
-	{
-		error("could not write to " + path);
-	}
+	return r;
 }
 
-void ImageMaker::png(
-	pair<Position, Camera> const * pos_b,
-	pair<Position, Camera> const * pos_e,
+Image ImageMaker::image(
+	pair<Position, Camera> const * const pos_b,
+	pair<Position, Camera> const * const pos_e,
 	unsigned const width, unsigned const height,
-	string const path, V3 const bg_color,
+	V3 const bg_color,
 	vector<View> const & view,
 	unsigned const grid_size, unsigned const grid_line_width) const
 {
-	if (boost::filesystem::exists(path)) return;
+	unsigned const ss = supersampling;
 
-	vector<boost::gil::rgb8_pixel_t> buf(width*2 * height*2);
-
-	if (!OSMesaMakeCurrent(ctx, buf.data(), GL_UNSIGNED_BYTE, width*2, height*2))
-		error("OSMesaMakeCurrent");
+	RGBA const * const buf = bind(width*ss, height*ss);
 
 	Style style;
 	style.grid_size = grid_size;
@@ -155,8 +215,7 @@ void ImageMaker::png(
 	style.grid_color = bg_color * .8;
 	style.background_color = bg_color;
 
-	glClearAccum(0.0, 0.0, 0.0, 0.0);
-	glClear(GL_ACCUM_BUFFER_BIT);
+	accumulator.reset();
 
 	for (pair<Position, Camera> const * p = pos_b; p != pos_e; ++p)
 	{
@@ -166,236 +225,257 @@ void ImageMaker::png(
 			graph, p->first, p->second,
 			none, // no highlighted joint
 			false, // not edit mode
-			0, 0, width*2, height*2,
+			0, 0, width*ss, height*ss,
 			{0},
 			style);
 
 		glFinish();
-		glAccum(GL_ACCUM, 1. / (pos_e - pos_b));
-	}
-
-	glAccum(GL_RETURN, 1.0);
-
-	foreach (p : buf) std::swap(p[0], p[2]);
-
-	vector<boost::gil::rgb8_pixel_t> buf2(width * height);
-
-	auto xy = [&](unsigned x, unsigned y){ return buf[y*width*2+x]; };
-
-	for (unsigned x = 0; x != width; ++x)
-	for (unsigned y = 0; y != height; ++y)
-	{
-		auto const & a = xy(x*2,  y*2  );
-		auto const & b = xy(x*2+1,y*2  );
-		auto const & c = xy(x*2,  y*2+1);
-		auto const & d = xy(x*2+1,y*2+1);
-
-		buf2[y*width+x][0] = (a[0] + b[0] + c[0] + d[0]) / 4;
-		buf2[y*width+x][1] = (a[1] + b[1] + c[1] + d[1]) / 4;
-		buf2[y*width+x][2] = (a[2] + b[2] + c[2] + d[2]) / 4;
+		accumulator.add(buf, size_t(width*ss) * height*ss);
 	}
-		// todo: clean up
 
-	boost::gil::png_write_view(path,
-		boost::gil::flipped_up_down_view(boost::gil::interleaved_view(width, height, buf2.data(), width*3)));
+	return downsample(accumulator.average(), width, height, ss);
 }
 
-void ImageMaker::png(
-	Position const pos,
+Image ImageMaker::image(
+	Position const & pos,
 	double const angle,
 	double const ymax,
-	string const filename,
 	unsigned const width, unsigned const height, V3 const bg_color) const
 {
-	if (boost::filesystem::exists(filename)) return;
+	return image(pos, turned(angle, ymax), width, height, bg_color, {{0, 0, 1, 1, none, 45}});
+}
 
-	Camera camera;
-	camera.hardSetOffset({0, ymax - 0.57, 0});
-	camera.zoom(0.55);
-	camera.rotateHorizontal(angle);
-	camera.rotateVertical((ymax - 0.6)/2);
+Camera ImageMaker::camera(ImageView const view, double const ymax)
+{
+	return view.heading ? turned(angle(*view.heading), ymax) : Camera();
+}
 
-	png(pos, camera, width, height, filename, bg_color, {{0, 0, 1, 1, none, 45}});
+Image ImageMaker::image(
+	Position const & pos,
+	Camera const & camera,
+	ImageView const view,
+	unsigned const width, unsigned const height,
+	V3 const bg_color) const
+{
+	return image(pos, camera, width, height, bg_color, window(view));
 }
 
-string ImageMaker::png(
-	string const output_dir,
+Image ImageMaker::image(
 	Position pos,
 	double const ymax,
 	ImageView const view,
 	unsigned const width, unsigned const height,
-	BgColor const bg_color, string const base_linkname) const
+	V3 const bg_color) const
 {
-	string const attrs = code(view) + to_string(width) + 'x' + to_string(height);
+	if (view.mirror) pos = mirror(pos);
 
-	string filename =
-		to_string(boost::hash_value(pos))
-		+ attrs
-		+ '-' + to_string(bg_color) + ".png";
+	return image(pos, camera(view, ymax), view, width, height, bg_color);
+}
 
-	if (!base_linkname.empty()) filename = "store/" + filename;
+ImagePlan::ImagePlan(string const d)
+	: output_dir(d)
+{}
 
-	if (view.mirror) pos = mirror(pos);
+void ImagePlan::add(string const filename, string const inputs, Job job, std::shared_ptr<void> batch)
+{
+	std::lock_guard<std::mutex> const lock(mutex);
+	++requested;
 
-	if (view.heading)
-		png(pos, angle(*view.heading), ymax, output_dir + "/" + filename, width, height, color(bg_color));
-	else if (view.player)
-	{
-		Camera camera;
+	jobs.emplace(filename, Planned{inputs, move(job), move(batch)});
+		// the names contain the inputs' digest, so a file planned twice shows the same thing
+}
 
-		png(pos, camera, width, height, output_dir + "/" + filename, color(bg_color),
-			{{0, 0, 1, 1, *view.player, 80}});
-	}
-	else abort();
+string ImagePlan::png(
+	Position const pos,
+	double const ymax,
+	ImageView const view,
+	unsigned const width, unsigned const height,
+	ImageMaker::BgColor const bg_color, string const base_linkname)
+{
+	string const
+		attrs = code(view) + to_string(width) + 'x' + to_string(height),
+		inputs = digest({pos}, "png" + attrs + to_string(bg_color) + bytes(ymax));
 
-	if (!base_linkname.empty())
-	{
-		string const linkname = output_dir + "/" + base_linkname + attrs + ".png";
+	string filename = inputs + attrs + '-' + to_string(bg_color) + ".png";
 
-		unlink(linkname.c_str());
-		if (symlink(filename.c_str(), linkname.c_str()))
-			perror("symlink");
-	}
+	if (!base_linkname.empty()) filename = "store/" + filename;
+
+	add("images/" + filename, inputs,
+		[=](ImageMaker const & mkimg, string const & path)
+		{
+			write_png(mkimg.image(pos, ymax, view, width, height, ImageMaker::color(bg_color)),
+				path, PngOptions::small());
+		});
+
+	if (!base_linkname.empty())
+		link(output_dir + "images", filename, base_linkname + attrs + ".png");
 
 	return filename;
 }
 
-string ImageMaker::rotation_gif(
-	string const output_dir, Position p, ImageView const view,
-	unsigned const width, unsigned const height, BgColor const bg_color,
-	string const base_linkname) const
+string ImagePlan::rotation_gif(
+	Position p, ImageView const view,
+	unsigned const width, unsigned const height, ImageMaker::BgColor const bg_color,
+	string const base_linkname)
 {
 	if (view.mirror) p = mirror(p);
 
-	string const base_filename = to_string(boost::hash_value(p)) + "rot" + to_string(bg_color);
-	string const gif_filename = "store/" + base_filename + ".gif";
+	string const inputs = digest({p}, "rot" + to_string(width) + 'x' + to_string(height) + to_string(bg_color));
+	string const gif_filename = "store/" + inputs + "rot" + to_string(bg_color) + ".gif";
 
 	string const linkname =
 		base_linkname +
 		to_string(width) + 'x' + to_string(height) +
 		'c' + to_string(bg_color) + ".gif";
 
-	double const ymax = std::max(.8, std::max(p[0][Head].y, p[1][Head].y));
-
-	make_gif(output_dir, gif_filename, 8, [&](string const gif_frames_dir)
+	add("images/" + gif_filename, inputs,
+		[=](ImageMaker const & mkimg, string const & path)
 		{
-			vector<string> frames;
+			double const ymax = std::max(.8, std::max(p[0][Head].y, p[1][Head].y));
+
+			vector<Image> frames;
 
 			for (auto i = 0; i < 360; i += 5)
-			{
-				string const frame_filename = base_filename + "-" + to_string(i) + "-" + to_string(bg_color) + ".png";
-				png(p, i/180.*pi(), ymax, gif_frames_dir + "/" + frame_filename, width, height, color(bg_color));
-				frames.push_back(frame_filename);
-			}
+				frames.push_back(mkimg.image(p, i/180.*pi(), ymax, width, height, ImageMaker::color(bg_color)));
 
-			return frames;
+			write_gif(path, frames, 8);
 		});
 
-	unlink((output_dir + "/" + linkname).c_str());
-	if (symlink(gif_filename.c_str(), (output_dir + "/" + linkname).c_str()))
-		perror("symlink");
+	link(output_dir + "images", gif_filename, linkname);
 
 	return linkname;
 }
 
-string ImageMaker::gif(
-	string const output_dir,
-	vector<Position> const & frames,
-	ImageView const view,
+void ImagePlan::gifs(
+	vector<Position> frames, vector<ImageView> const & views,
 	unsigned const width, unsigned const height,
-	BgColor const bg_color, string const base_linkname) const
+	ImageMaker::BgColor const bg_color, string const link_prefix)
 {
-	string const attrs = to_string(width) + 'x' + to_string(height) + code(view);
+	if (link_prefix.empty())
+		error("gifs must have name for symlink");
 
-	string filename
-		= "store/" + to_string(boost::hash_value(frames))
-		+ attrs + '-' + to_string(bg_color) + ".gif";
+	auto const animation = std::make_shared<Animation>(move(frames));
+	Animation * const a = animation.get(); // owned by the batch for as long as the jobs run
+	vector<Position> const & v = a->positions();
 
-	make_gif(output_dir, filename, 3, [&](string const gif_frames_dir)
-		{
-			vector<double> ymaxes;
-			foreach (pos : frames)
-				ymaxes.push_back(std::max(.8, std::max(pos[0][Head].y, pos[1][Head].y)));
-			for (int i = 0; i != 10; ++i)
-				ymaxes = smoothen_v(ymaxes);
+	string const attrs = to_string(width) + 'x' + to_string(height) + '-' + to_string(bg_color);
 
-			vector<string> v;
-			int i = 0;
-			foreach (pos : frames)
+	foreach (view : views)
+	{
+		string const
+			suffix = code(view) + string(".gif"),
+			inputs = digest(v, "gif" + to_string(width) + 'x' + to_string(height) + code(view) + to_string(bg_color)),
+			filename = "store/" + inputs + attrs + suffix;
+
+		add("images/" + filename, inputs,
+			[=](ImageMaker const & mkimg, string const & path)
 			{
-				v.push_back(
-					png(gif_frames_dir, pos, ymaxes[i], view, width, height, bg_color,
-						"" /* no symlink */));
-				++i;
-			}
-			return v;
-		});
+				write_gif(path, a->images(mkimg, view, width, height, ImageMaker::color(bg_color)), 3);
+			},
+			animation);
 
-	if (base_linkname.empty())
-		error("gifs must have name for symlink");
+		link(output_dir + "images", filename, link_prefix + suffix);
+	}
+}
 
-	string const linkname = output_dir + "/" + base_linkname + attrs + ".gif";
+string ImagePlan::gifs(
+	vector<Position> frames,
+	unsigned const width, unsigned const height,
+	ImageMaker::BgColor const bg_color, string const base_linkname)
+{
+	string const ext_linkbase = base_linkname
+		+ to_string(width) + 'x' + to_string(height) + '-' + to_string(bg_color);
 
-	unlink(linkname.c_str());
-	if (symlink(filename.c_str(), linkname.c_str()))
-		perror("symlink");
+	gifs(move(frames), views(), width, height, bg_color, ext_linkbase);
 
-	return linkname;
+	return ext_linkbase;
 }
 
-string ImageMaker::gifs(
-	string const output_dir,
-	vector<Position> const & frames,
-	unsigned const width, unsigned const height,
-	BgColor const bg_color, string const base_linkname) const
+void ImagePlan::render(Graph const & graph, unsigned const threads, Manifest & manifest)
 {
-	string const
-		attrs = to_string(width) + 'x' + to_string(height) + '-' + to_string(bg_color),
-		base_filename = to_string(boost::hash_value(frames)) + attrs,
-		ext_linkbase = base_linkname + attrs;
+	map<string, Manifest::Output> outputs;
+	vector<pair<string, Planned *>> todo;
 
-	foreach (view : views())
+	foreach (j : jobs)
 	{
-		string const
-			suffix = code(view) + string(".gif"),
-			filename = "store/" + base_filename + suffix,
-			linkname = output_dir + "/" + ext_linkbase + suffix;
+		auto const i = manifest.outputs.find(j.first);
+		bool const listed = i != manifest.outputs.end();
+
+		if (listed && i->second.inputs != j.second.inputs)
+			todo.emplace_back(j.first, &j.second); // was made from something else
+		else if (!boost::filesystem::exists(output_dir + j.first))
+			todo.emplace_back(j.first, &j.second);
+		else
+			outputs[j.first] = listed ? i->second
+				: Manifest::Output{j.second.inputs, md5_of_file(output_dir + j.first)};
+					// made before there was a manifest
+	}
 
-		make_gif(output_dir, filename, 3, [&](string const gif_frames_dir)
-			{
-				vector<string> v;
-
-				vector<double> ymaxes;
-				foreach (pos : frames)
-					ymaxes.push_back(std::max(.8, std::max(pos[0][Head].y, pos[1][Head].y)));
-				for (int i = 0; i != 10; ++i)
-					ymaxes = smoothen_v(ymaxes);
-
-				int i = 0;
-				foreach (pos : frames)
-				{
-					v.push_back(
-						png(gif_frames_dir, pos, ymaxes[i], view, width, height, bg_color,
-							"" /* no symlink */));
-					++i;
-				}
-
-				return v;
-			});
-
-		unlink(linkname.c_str());
-		if (symlink(filename.c_str(), linkname.c_str()))
-			perror("symlink");
+	std::cout
+		<< "Planned " << jobs.size() << " images for " << requested << " uses, "
+		<< jobs.size() - todo.size() << " up to date, rendering " << todo.size() << "."
+		<< std::endl;
+
+	vector<vector<size_t>> batches; // indices into todo
+	map<void const *, size_t> batch_index;
+
+	for (size_t i = 0; i != todo.size(); ++i)
+	{
+		void const * const b = todo[i].second->batch.get();
+
+		if (!b) batches.push_back({i});
+		else
+		{
+			auto const r = batch_index.emplace(b, batches.size());
+			if (r.second) batches.emplace_back();
+			batches[r.first->second].push_back(i);
+		}
 	}
 
-	return ext_linkbase;
+	vector<string> contents(todo.size());
+
+	parallel_for(batches.size(), [&](size_t const b)
+		{
+			thread_local std::unique_ptr<ImageMaker> mkimg;
+			thread_local Graph const * mkimg_graph = nullptr;
+				// an OSMesa context can only be current in one thread at a time
+
+			if (!mkimg || mkimg_graph != &graph)
+			{
+				mkimg.reset(new ImageMaker(graph));
+				mkimg_graph = &graph;
+			}
+
+			foreach (i : batches[b])
+			{
+				string const path = output_dir + todo[i].first;
+
+				todo[i].second->job(*mkimg, path);
+				contents[i] = md5_of_file(path);
+
+				std::cout << '.' << std::flush;
+			}
+
+			foreach (i : batches[b]) todo[i].second->batch.reset();
+		}, threads);
+
+	for (size_t i = 0; i != todo.size(); ++i)
+		outputs[todo[i].first] = Manifest::Output{todo[i].second->inputs, contents[i]};
+
+	std::cout << "\nRendered " << todo.size() << " images." << std::endl;
+
+	manifest.outputs = move(outputs);
+	jobs.clear();
+	requested = 0;
 }
 
-ImageMaker::ImageMaker(Graph const & g)
+ImageMaker::ImageMaker(Graph const & g, unsigned const ss)
 	: graph(g)
-	, ctx(OSMesaCreateContextExt(OSMESA_RGB, 16, 0, 16, nullptr))
+	, supersampling(ss)
+	, ctx(OSMesaCreateContextExt(OSMESA_RGBA, 16, 0, 0, nullptr))
 {
 	if (!ctx) error("OSMeseCreateContextExt failed");
+	if (!ss) error("supersampling factor must be positive");
 }
 
 ImageMaker::~ImageMaker()
@@ -4,27 +4,46 @@
 #include "graph.hpp"
 #include "headings.hpp"
 #include "rendering.hpp"
+#include "image.hpp"
+#include "persistence.hpp"
 #include <GL/osmesa.h>
+#include <functional>
+#include <memory>
+#include <mutex>
 
 namespace GrappleMap {
 
+struct RenderTimes // seconds spent in ImageMaker::image, by stage
+{
+	double render = 0;
+	double readback = 0; // waiting for OSMesa to finish drawing into our framebuffer
+	double downsample = 0;
+};
+
 class ImageMaker
 {
 	Graph const & graph;
+	unsigned const supersampling;
 	OSMesaContext ctx = nullptr;
+	mutable vector<RGBA> framebuffer;
+	mutable unsigned framebuffer_width = 0;
+	mutable Accumulator accumulator;
+	RenderTimes * times = nullptr;
 
-	void png(
-		Position pos, double angle, double ymax, string filename,
-		unsigned width, unsigned height, V3 bg_color) const;
+	RGBA * bind(unsigned width, unsigned height) const;
+		// makes the context current on a framebuffer of that size, unless it already is
 
 public:
 
-	ImageMaker(Graph const &);
+	explicit ImageMaker(Graph const &, unsigned supersampling = 2);
+		// renders at supersampling times the requested size and scales down
 	~ImageMaker();
 
 	ImageMaker(ImageMaker const &) = delete;
 	ImageMaker & operator=(ImageMaker const &) = delete;
 
+	void record_times(RenderTimes * t) { times = t; } // added to by each image(), if not null
+
 	enum BgColor { RedBg, BlueBg, WhiteBg };
 
 	static V3 color(BgColor const c)
@@ -49,42 +68,92 @@ public:
 		}
 	}
 
-	void png(
-		Position,
-		Camera const &,
-		unsigned width, unsigned height,
-		string path, V3 bg_color,
+	Image image(
+		Position const &, Camera const &,
+		unsigned width, unsigned height, V3 bg_color,
 		vector<View> const &, unsigned grid_size = 2, unsigned grid_line_width = 2) const;
 
-	void png(
+	Image image(
+		Position const &, double angle, double ymax,
+		unsigned width, unsigned height, V3 bg_color) const;
+
+	static Camera camera(ImageView, double ymax); // the same for mirrored views
+
+	Image image(
+		Position const &, Camera const &, ImageView,
+		unsigned width, unsigned height, V3 bg_color) const;
+			// the position must already be mirrored if the view is
+
+	Image image(
+		Position, double ymax, ImageView,
+		unsigned width, unsigned height, V3 bg_color) const;
+
+	Image image(
 		pair<Position, Camera> const * pos_beg,
 		pair<Position, Camera> const * pos_end,
-		unsigned width, unsigned height,
-		string path, V3 bg_color,
+		unsigned width, unsigned height, V3 bg_color,
 		vector<View> const &, unsigned grid_size = 2, unsigned grid_line_width = 2) const;
+			// the average of several renders, for motion blur
+};
+
+class ImagePlan
+	// The image files that pages refer to, named after a digest of what they show, so that
+	// each is rendered once however many pages use it. Symlinks to them are made while
+	// planning, the files themselves by render(). Planning may happen on several threads.
+{
+	using Job = std::function<void(ImageMaker const &, string const & path)>;
+
+	struct Planned
+	{
+		string inputs; // digest of everything the image shows
+		Job job;
+		std::shared_ptr<void> batch;
+			// what the jobs planned with it share, like the frames of an animation seen from
+			// different angles; they are rendered together, after which it is released
+	};
+
+	string const output_dir; // images go in its images/ subdirectory
+	std::mutex mutex;
+	map<string, Planned> jobs; // by path relative to output_dir
+	size_t requested = 0;
+
+	void add(string filename, string inputs, Job, std::shared_ptr<void> batch = nullptr);
+
+public:
+
+	explicit ImagePlan(string output_dir);
+
+	ImagePlan(ImagePlan const &) = delete;
+	ImagePlan & operator=(ImagePlan const &) = delete;
+
+	// The names returned are relative to the images directory.
 
 	string png(
-		string output_dir, Position, double ymax, ImageView,
-		unsigned width, unsigned height, BgColor,
-		string base_linkname) const;
+		Position, double ymax, ImageView,
+		unsigned width, unsigned height, ImageMaker::BgColor,
+		string base_linkname);
 
 	string rotation_gif(
-		string output_dir, Position, ImageView,
-		unsigned width, unsigned height, BgColor,
-		string base_linkname) const;
+		Position, ImageView,
+		unsigned width, unsigned height, ImageMaker::BgColor,
+		string base_linkname);
 
-	string gif(
-		string output_dir,
-		vector<Position> const & frames,
-		ImageView,
-		unsigned width, unsigned height, BgColor,
-		string base_linkname) const;
+	void gifs(
+		vector<Position> frames, vector<ImageView> const &,
+		unsigned width, unsigned height, ImageMaker::BgColor,
+		string link_prefix);
+			// one per view, linked as link_prefix + code(view) + ".gif"; the frames
+			// are kept until the views are rendered, once for all of them
 
 	string gifs(
-		string output_dir,
-		vector<Position> const & frames,
-		unsigned width, unsigned height, BgColor,
-		string base_linkname) const;
+		vector<Position> frames,
+		unsigned width, unsigned height, ImageMaker::BgColor,
+		string base_linkname);
+			// for all views(), linked as the returned name + code(view) + ".gif"
+
+	void render(Graph const &, unsigned threads, Manifest &);
+		// Makes the planned files that are missing or that the manifest says were
+		// made from something else, and replaces the manifest's outputs with them.
 };
 
 }
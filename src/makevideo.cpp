@@ -5,10 +5,10 @@
 #include "graph_util.hpp"
 #include "images.hpp"
 #include "paths.hpp"
+#include "distances.hpp"
+#include "video.hpp"
 #include <boost/program_options.hpp>
 #include <iostream>
-#include <sstream>
-#include <iomanip>
 
 using namespace GrappleMap;
 
@@ -16,12 +16,19 @@ struct Config
 {
 	string db;
 	string script;
+	optional<PathCost> fill_gaps;
+	bool cache_distances;
 	unsigned frames_per_pos;
 	unsigned num_transitions;
 	string start;
 	optional<string /* desc */> demo;
+	optional<size_t> demo_limit;
 	pair<unsigned, unsigned> dimensions;
 	optional<uint32_t> seed;
+	string format;
+	unsigned fps;
+	unsigned supersampling;
+	unsigned motion_blur;
 };
 
 optional<Config> config_from_args(int const argc, char const * const * const argv)
@@ -35,12 +42,23 @@ optional<Config> config_from_args(int const argc, char const * const * const arg
 			"number of frames rendered per position")
 		("script", po::value<string>()->default_value(string()),
 			"script file")
+		("fill-gaps", po::value<string>(),
+			"let script lines skip ahead, filling in the path with the fewest \"transitions\" or \"frames\"")
+		("cache-distances", "keep the table that script errors suggest routes from in <db>.distances")
 		("start", po::value<string>()->default_value("staredown"), "initial position")
 		("length", po::value<unsigned>()->default_value(50), "number of transitions")
 		("dimensions", po::value<string>()->default_value("1280x720"), "video resolution")
 		("seed", po::value<uint32_t>(), "PRNG seed")
 		("db", po::value<string>()->default_value("GrappleMap.txt"), "database file")
-		("demo", po::value<string>(), "show all chains of three transitions that have the given transition in the middle");
+		("demo", po::value<string>(), "show all chains of three transitions that have the given transition in the middle")
+		("demo-limit", po::value<size_t>(), "show only this many of those chains, picked at random")
+		("format", po::value<string>()->default_value("png"),
+			"png (vidframes/frame00000.png etc), y4m (YUV4MPEG2 on stdout), or raw (rgb24 on stdout)")
+		("fps", po::value<unsigned>()->default_value(60), "frame rate recorded in y4m output")
+		("supersampling", po::value<unsigned>()->default_value(2),
+			"render at this many times the resolution and scale down (2 and 4 are fastest)")
+		("motion-blur", po::value<unsigned>()->default_value(1),
+			"average this many renders spread over the time since the previous frame (1 to 257)");
 
 	po::variables_map vm;
 	po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -48,6 +66,9 @@ optional<Config> config_from_args(int const argc, char const * const * const arg
 
 	if (vm.count("help")) { cout << desc << '\n'; return none; }
 
+	if (vm.count("demo-limit") && vm["demo-limit"].as<size_t>() == 0)
+		throw runtime_error("--demo-limit must be at least 1");
+
 	string const dims = vm["dimensions"].as<string>();
 	auto x = dims.find('x');
 	if (x == dims.npos) throw runtime_error("invalid dimensions");
@@ -56,12 +77,19 @@ optional<Config> config_from_args(int const argc, char const * const * const arg
 	return Config
 		{ vm["db"].as<string>()
 		, vm["script"].as<string>()
+		, vm.count("fill-gaps") ? optional<PathCost>(path_cost(vm["fill-gaps"].as<string>())) : boost::none
+		, vm.count("cache-distances") != 0
 		, vm["frames-per-pos"].as<unsigned>()
 		, vm["length"].as<unsigned>()
 		, vm["start"].as<string>()
 		, vm.count("demo") ? optional<string>(vm["demo"].as<string>()) : boost::none
+		, optionalopt<size_t>(vm, "demo-limit")
 		, dimensions
 		, optionalopt<uint32_t>(vm, "seed")
+		, vm["format"].as<string>()
+		, vm["fps"].as<unsigned>()
+		, vm["supersampling"].as<unsigned>()
+		, vm["motion-blur"].as<unsigned>()
 		};
 }
 
@@ -78,19 +106,94 @@ int main(int const argc, char const * const * const argv)
 
 		Graph const graph = loadGraph(config->db);
 
-		ImageMaker mkImg(graph);
+		ImageMaker mkImg(graph, config->supersampling);
+
+		ostream & log = config->format == "png" ? cout : cerr;
+			// stdout may be taken by the frames
+
+		FrameWriter writer(frame_sink(config->format, "vidframes", config->fps));
+
+		unsigned const blur = config->motion_blur;
+		if (blur == 0 || blur > 257) throw runtime_error("--motion-blur must be between 1 and 257");
+
+		int const
+			width = config->dimensions.first,
+			height = config->dimensions.second;
+
+		auto const windows = third_person_windows_in_corner(.3,.3,.01,.01 * (double(width)/height));
+
+		unsigned frameindex = 0, transitions = 0;
+
+		Camera camera;
+		camera.zoom(1.2);
+
+		optional<Position> prev;
+		vector<pair<Position, Camera>> subframes;
+
+		auto const play = [&](Frames const & fr)
+			// may be called several times, with the frames of consecutive scenes
+		{
+			if (!prev)
+			{
+				prev = fr.front().second.front();
+				camera.hardSetOffset(cameraOffsetFor(*prev));
+			}
+
+			foreach (transition : fr)
+			{
+				foreach (pos : transition.second)
+				{
+					Camera const prev_camera = camera;
+
+					camera.rotateHorizontal(-0.012);
+					camera.setOffset(cameraOffsetFor(pos));
+
+					subframes.clear();
+
+					for (unsigned k = 1; k <= blur; ++k)
+					{
+						double const t = double(k) / blur;
+
+						Camera c = prev_camera;
+						c.rotateHorizontal(-0.012 * t);
+						c.hardSetOffset(prev_camera.getOffset() + (camera.getOffset() - prev_camera.getOffset()) * t);
+
+						subframes.emplace_back(between(*prev, pos, t), c);
+					}
 
-		Frames fr;
+					prev = pos;
+
+					writer.write(blur == 1
+						? mkImg.image(pos, camera, width, height,
+							white, // background
+//							{{0, 0, 1, 1, none, 50}}, // view
+							windows,
+							20, // grid size
+							4) // grid line width
+						: mkImg.image(subframes.data(), subframes.data() + subframes.size(), width, height,
+							white, windows, 20, 4));
+
+					++frameindex;
+				}
+
+				log << transitions++ << ' ' << std::flush;
+			}
+
+			return true;
+		};
 
 		if (config->demo)
 		{
 			if (auto step = step_by_desc(graph, *config->demo))
-				fr = demoFrames(graph, *step, config->frames_per_pos);
+				demoFrames(graph, *step, config->frames_per_pos, config->demo_limit, play);
 			else
 				throw runtime_error("no such transition: " + *config->demo);
 		}
 		else if (!config->script.empty())
-			fr = smoothen(frames(graph, readScene(graph, config->script), config->frames_per_pos));
+		{
+			Distances const distances = config->cache_distances ? loadDistances(graph, config->db) : Distances(graph);
+			play(smoothen(frames(graph, readScene(graph, config->script, &distances, config->fill_gaps), config->frames_per_pos)));
+		}
 		else if (optional<NodeNum> start = node_by_desc(graph, config->start))
 		{
 			Frames x = frames(graph, randomScene(graph, *start, config->num_transitions), config->frames_per_pos);
@@ -102,48 +205,14 @@ int main(int const argc, char const * const * const argv)
 			v.insert(v.begin(), config->frames_per_pos * 15, firstpos);
 			w.insert(w.end(), config->frames_per_pos * 15, lastpos);
 
-			fr = smoothen(x);
+			play(smoothen(x));
 		}
 		else
 			throw runtime_error("no such position/transition: " + config->start);
 
-		unsigned frameindex = 0;
-
-		string const separator = "      ";
-
-		Camera camera;
-		camera.zoom(1.2);
-		camera.hardSetOffset(cameraOffsetFor(fr.front().second.front()));
-
-		for (auto i = fr.begin(); i != fr.end(); ++i)
-		{
-			foreach (pos : i->second)
-			{
-				camera.rotateHorizontal(-0.012);
-				camera.setOffset(cameraOffsetFor(pos));
-
-				int const
-					width = config->dimensions.first,
-					height = config->dimensions.second;
-
-				std::ostringstream fn;
-				fn << "vidframes/frame" << std::setw(5) << std::setfill('0') << frameindex << ".png";
-
-				mkImg.png(pos, camera, width, height, fn.str(),
-					white, // background
-//					{{0, 0, 1, 1, none, 50}}, // view
-					third_person_windows_in_corner(.3,.3,.01,.01 * (double(width)/height)),
-					20, // grid size
-					4 // grid line width
-					);
-
-				++frameindex;
-			}
-
-			cout << (i - fr.begin()) << ' ' << std::flush;
-		}
+		writer.finish();
 
-		cout << "\nGenerated " << frameindex << " frames.\n";
+		log << "\nGenerated " << frameindex << " frames.\n";
 	}
 	catch (exception const & e)
 	{
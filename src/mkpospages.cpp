@@ -1,7 +1,6 @@
 #define BOOST_NO_CXX11_SCOPED_ENUMS
 	// see https://www.robertnitsch.de/notes/cpp/cpp11_boost_filesystem_undefined_reference_copy_file
 
-#include "png.h"
 #include "util.hpp"
 #include "headings.hpp"
 #include "camera.hpp"
@@ -12,11 +11,14 @@
 #include "rendering.hpp"
 #include "images.hpp"
 #include "graph_util.hpp"
+#include "parallel.hpp"
 #include <boost/program_options.hpp>
 #include <iostream>
 #include <iomanip>
 #include <vector>
 #include <fstream>
+#include <sstream>
+#include <thread>
 
 using namespace GrappleMap;
 
@@ -31,12 +33,6 @@ inline std::size_t hash_value(V3 const v) // todo: put elsewhere
 
 #include <boost/functional/hash.hpp>
 
-#ifndef int_p_NULL // ffs
-	#define int_p_NULL (int*)NULL // https://github.com/ignf/gilviewer/issues/8
-#endif
-
-#include <boost/gil/extension/io/png_io.hpp>
-#include <boost/gil/gil_all.hpp>
 #include <boost/filesystem.hpp>
 
 namespace
@@ -61,6 +57,7 @@ namespace
 		string db;
 		string output_dir;
 		optional<string> image_url;
+		unsigned jobs;
 	};
 
 	template<typename T>
@@ -85,7 +82,10 @@ namespace
 				po::value<string>())
 			("db",
 				po::value<string>()->default_value("GrappleMap.txt"),
-				"database file");
+				"database file")
+			("jobs,j",
+				po::value<unsigned>()->default_value(std::max(1u, std::thread::hardware_concurrency())),
+				"number of rendering threads");
 
 		po::variables_map vm;
 		po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -104,12 +104,20 @@ namespace
 		return Config
 			{ vm["db"].as<string>()
 			, vm["output_dir"].as<string>()
-			, opt_arg<string>(vm, "image_url") };
+			, opt_arg<string>(vm, "image_url")
+			, std::max(1u, vm["jobs"].as<unsigned>()) };
+	}
+
+	string thread_suffix()
+	{
+		std::ostringstream s;
+		s << '.' << std::this_thread::get_id();
+		return s.str();
 	}
 
 	vector<Position> frames_for_sequence(Graph const & graph, SeqNum const seqNum)
 	{
-		unsigned const frames_per_pos = is_detailed(graph[seqNum]) ? 3 : 5;
+		unsigned const frames_per_pos = is_detailed(graph, seqNum) ? 3 : 5;
 
 		PositionInSequence location{seqNum, 0};
 
@@ -182,7 +190,7 @@ namespace
 		html << "</ul><h2>Untagged positions</h2><ul>";
 
 		foreach(n : nodenums(g))
-			if (tags(g[n]).empty())
+			if (g.tags(n).none())
 				html << "<li><a href='p" << n.index << "n.html'>" << nlspace(desc(g[n])) << "</a></li>";
 
 		html << "</ul></body></html>";
@@ -232,7 +240,7 @@ namespace
 				<< "<td><a href='position/" << n.index << "n.html'>" << nlspace(desc(g[n])) << "</a></td>"
 				<< "<td>" << in(g, n).size() << "</td>"
 				<< "<td>" << out(g, n).size() << "</td>"
-				<< "<td>" << tags(g[n]).size() << "</td>"
+				<< "<td>" << g.tags(n).count() << "</td>"
 				<< "</tr>";
 
 		html
@@ -243,14 +251,8 @@ namespace
 
 		foreach(s : seqnums(g))
 		{
-			set<string> tt = tags(g[s]);
-
-			{
-				set<string> const from_tags = tags(g[g.from(s).node]);
-				foreach(t : tags(g[g.to(s).node]))
-					if (from_tags.find(t) != from_tags.end())
-						tt.insert(t);
-			}
+			set<string> const tt = names(g.tag_dictionary(),
+				g.tags(s) | (g.tags(g.from(s).node) & g.tags(g.to(s).node)));
 
 			html
 				<< "<tr>"
@@ -274,15 +276,20 @@ namespace
 		string const dot = dotstream.str();
 
 		string const
-			dotpath = output_dir + "tmp.dot",
+			dotpath = output_dir + "tmp" + thread_suffix() + ".dot",
 			svgpath = output_dir + to_string(boost::hash_value(dot)) + ".svg";
 
 		if (!boost::filesystem::exists(svgpath))
 		{
+			string const tmppath = svgpath + thread_suffix();
+				// renamed into place, since other threads may be making the same svg
+
 			{ std::ofstream dotfile(dotpath); dotfile << dot; }
-			auto const cmd = "dot -Tsvg " + dotpath + " -o" + svgpath;
+			auto const cmd = "dot -Tsvg " + dotpath + " -o" + tmppath;
 			if (std::system(cmd.c_str()) != 0)
 				throw runtime_error("dot fail");
+
+			boost::filesystem::rename(tmppath, svgpath);
 		}
 
 		std::ifstream svgfile(svgpath);
@@ -341,25 +348,14 @@ namespace
 		return v;
 	}
 
-	void transition_gif(
-		ImageMaker const & mkimg,
-		string const output_dir,
-		vector<Position> frames,
-		ImageView const v,
-		ImageMaker::BgColor const bg_color,
-		string const base_linkname)
-	{
-		mkimg.gif(output_dir + "/images/", smoothen(frames), v, 200, 150, bg_color, base_linkname);
-	}
-
 	string transition_gifs(
-		ImageMaker const & mkimg,
-		string const output_dir,
-		vector<Position> frames,
+		ImagePlan & images,
+		vector<Position> const frames,
 		ImageMaker::BgColor const bg_color,
 		string const base_linkname)
 	{
-		return mkimg.gifs(output_dir + "/images/", smoothen(frames), 200, 150, bg_color, base_linkname);
+		return images.gifs(smoothen(frames),
+			200, 150, bg_color, base_linkname);
 	}
 
 	ImageView xmirror(ImageView const v)
@@ -423,12 +419,10 @@ namespace
 		return distanceSquared(p[0][Core], p[1][Core]);
 	}
 
-	void write_transition_gifs(ImageMaker const & mkimg, Graph const & g, string const output_dir)
+	void write_transition_gifs(ImagePlan & images, Graph const & g)
 	{
 		foreach (sn : seqnums(g))
 		{
-			cout << '.' << std::flush;
-
 			auto const props = properties(g, sn);
 
 			bool top = props.count("top") != 0;
@@ -443,14 +437,23 @@ namespace
 
 			foreach (p : frames) p = reo(p);
 
-			foreach (v : views())
-				transition_gif(
-					mkimg, output_dir, frames, v,
-					bg_color(top, bottom),
-					't' + to_string(sn.index));
+			images.gifs(smoothen(frames), views(), 200, 150,
+				bg_color(top, bottom),
+				't' + to_string(sn.index) + "200x150");
 		}
+	}
 
-		std::endl(cout);
+	string page_filename(NodeNum const n, ImageView const v)
+	{
+		return "position/" + to_string(n.index) + code(v) + ".html";
+	}
+
+	bool outputs_exist(Manifest const & m, string const & output_dir)
+	{
+		foreach (o : m.outputs)
+			if (!boost::filesystem::exists(output_dir + o.first)) return false;
+
+		return !m.outputs.empty();
 	}
 
 	namespace position_page
@@ -468,7 +471,7 @@ namespace
 		
 		struct Context
 		{
-			ImageMaker const & mkimg;
+			ImagePlan & images;
 			std::ostream & html;
 			Graph const & graph;
 			NodeNum n;
@@ -506,8 +509,8 @@ namespace
 					<< div("display:inline-block",
 						link(to_string(trans.other_node.index) + code(v) + ".html",
 							img(position_image_title(ctx.graph, trans.other_node),
-								ctx.image_url + "/" + ctx.mkimg.rotation_gif(
-									ctx.output_dir + "/images/", translateNormal(trans.frames.front()),
+								ctx.image_url + "/" + ctx.images.rotation_gif(
+									translateNormal(trans.frames.front()),
 									ctx.view, 200, 150, bg_color(trans),
 									"rot" + to_string(ctx.n.index)
 									+ "in" + to_string(trans.step.seq.index) + code(v)),
@@ -535,8 +538,8 @@ namespace
 					<< link(
 						to_string(trans.other_node.index) + code(v) + ".html",
 						img(position_image_title(ctx.graph, trans.other_node),
-							ctx.image_url + "/" + ctx.mkimg.rotation_gif(
-								ctx.output_dir + "/images/", translateNormal(trans.frames.back()),
+							ctx.image_url + "/" + ctx.images.rotation_gif(
+								translateNormal(trans.frames.back()),
 								ctx.view, 200, 150, bg_color(trans),
 								"rot" + to_string(ctx.n.index)
 								+ "out" + to_string(trans.step.seq.index) + code(v)),
@@ -553,7 +556,7 @@ namespace
 
 			int i = 0;
 
-			foreach (tag : tags(ctx.graph[ctx.n]))
+			foreach (tag : tags(ctx.graph, ctx.n))
 			{
 				if (i != 0)
 				{
@@ -591,11 +594,11 @@ namespace
 
 			double const ymax = std::max(.8, std::max(pos_to_show[0][Head].y, pos_to_show[1][Head].y));
 
-			ctx.mkimg.png(ctx.output_dir + "/images/", pos_to_show, ymax, ctx.view,
-				480, 360, ctx.mkimg.WhiteBg, 'p' + to_string(ctx.n.index));
+			ctx.images.png(pos_to_show, ymax, ctx.view,
+				480, 360, ImageMaker::WhiteBg, 'p' + to_string(ctx.n.index));
 
-			ctx.mkimg.png(ctx.output_dir + "/images/", pos_to_show, ymax, ctx.view,
-				320, 240, ctx.mkimg.WhiteBg, 'p' + to_string(ctx.n.index));
+			ctx.images.png(pos_to_show, ymax, ctx.view,
+				320, 240, ImageMaker::WhiteBg, 'p' + to_string(ctx.n.index));
 
 			ctx.html
 				<< "<h1><a href='https://github.com/Eelis/GrappleMap/blob/master/doc/FAQ.md'>GrappleMap</a></h1>"
@@ -640,7 +643,7 @@ namespace
 				<< make_svg(ctx.graph, m, hc, ctx.output_dir) << "</body></html>";
 		}
 
-		void write_it(ImageMaker const & mkimg, Graph const & graph, NodeNum const n,
+		void write_it(ImagePlan & images, Graph const & graph, NodeNum const n,
 			string const output_dir, string const image_url)
 		{
 			cout << ' ' << n.index << std::flush;
@@ -688,7 +691,7 @@ namespace
 				auto const p = trans.frames.front();
 				trans.frames.insert(trans.frames.begin(), longest_in - trans.frames.size(), p);
 				trans.base_filename = transition_gifs(
-					mkimg, output_dir, trans.frames, bg_color(trans),
+					images, trans.frames, bg_color(trans),
 					to_string(n.index) + "in" + to_string(trans.step.seq.index));
 			}
 
@@ -713,7 +716,7 @@ namespace
 				auto const p = trans.frames.back();
 				trans.frames.insert(trans.frames.end(), longest_out - trans.frames.size(), p);
 				trans.base_filename = transition_gifs(
-					mkimg, output_dir, trans.frames, bg_color(trans),
+					images, trans.frames, bg_color(trans),
 					to_string(n.index) + "out" + to_string(trans.step.seq.index));
 			}
 
@@ -731,9 +734,9 @@ namespace
 
 			foreach (v : views())
 			{
-				ofstream html(output_dir + "/position/" + to_string(n.index) + code(v) + ".html");
+				ofstream html(output_dir + page_filename(n, v));
 				write_page(Context
-					{ mkimg, html, graph, n, incoming, outgoing
+					{ images, html, graph, n, incoming, outgoing
 					, v, output_dir, image_url, query_for(graph, n) });
 			}
 		}
@@ -747,31 +750,57 @@ int main(int const argc, char const * const * const argv)
 		optional<Config> const config = config_from_args(argc, argv);
 		if (!config) return 0;
 
-		string const output_dir = config->output_dir + "/GrappleMap/";
+		string const
+			output_dir = config->output_dir + "/GrappleMap/",
+			manifest_file = output_dir + "manifest.txt",
+			source = md5(md5_of_file(config->db) + '\n' + config->image_url.value_or(""));
+
+		Manifest manifest = loadManifest(manifest_file);
+
+		if (manifest.source == source && outputs_exist(manifest, output_dir))
+		{
+			cout << config->db << " has not changed since the last run, nothing to do.\n";
+			return 0;
+		}
 
 		Graph const graph = loadGraph(config->db);
 
 		write_lists(graph, output_dir);
 		write_todo(graph, output_dir);
 
-		ImageMaker const mkimg(graph);
+		ImagePlan images(output_dir);
 
-		write_transition_gifs(mkimg, graph, output_dir);
+		write_transition_gifs(images, graph);
 
-		ofstream(output_dir + "/config.js")
+		ofstream(output_dir + "config.js")
 			<< "image_url='"
 			<< (config->image_url
 					? *(config->image_url)
 					: "images/")
 			<< "';";
 
-		foreach (n : nodenums(graph))
-			position_page::write_it(mkimg, graph, n, output_dir,
-				config->image_url
-					? *(config->image_url)
-					: "../images/");
+		parallel_for(graph.num_nodes(), [&](size_t const i)
+			{
+				position_page::write_it(images, graph, NodeNum{uint16_t(i)}, output_dir,
+					config->image_url
+						? *(config->image_url)
+						: "../images/");
+			}, config->jobs);
 
 		cout << '\n';
+
+		images.render(graph, config->jobs, manifest);
+
+		vector<string> pages{"lists.html", "todo.html", "config.js"};
+		foreach (n : nodenums(graph))
+		foreach (v : views())
+			pages.push_back(page_filename(n, v));
+
+		foreach (p : pages)
+			manifest.outputs[p] = Manifest::Output{source, md5_of_file(output_dir + p)};
+
+		manifest.source = source;
+		save(manifest, manifest_file);
 	}
 	catch (exception const & e)
 	{
@@ -0,0 +1,205 @@
+#ifndef GRAPPLEMAP_PARALLEL_HPP
+#define GRAPPLEMAP_PARALLEL_HPP
+
+#include "util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace GrappleMap {
+
+template<typename F>
+void parallel_for(size_t const n, F const & f, size_t const max_threads = 0)
+	// Calls f(i) for every i in [0, n), spread over max_threads threads, or all cores if 0.
+	// If any call throws, the exception from the lowest i is rethrown, as a sequential loop would.
+{
+	size_t const threads = std::min<size_t>(n,
+		max_threads ? max_threads : std::max(1u, std::thread::hardware_concurrency()));
+
+	if (threads <= 1)
+	{
+		for (size_t i = 0; i != n; ++i) f(i);
+		return;
+	}
+
+	std::atomic<size_t> next{0};
+	std::mutex mutex;
+	size_t failed_at = n;
+	std::exception_ptr failure;
+
+	auto work = [&]
+		{
+			for (size_t i; (i = next++) < n; )
+				try { f(i); }
+				catch (...)
+				{
+					std::lock_guard<std::mutex> const lock(mutex);
+					if (i < failed_at) { failed_at = i; failure = std::current_exception(); }
+					next = n;
+				}
+		};
+
+	vector<std::thread> v;
+	for (size_t t = 1; t != threads; ++t) v.emplace_back(work);
+	work();
+	foreach (t : v) t.join();
+
+	if (failure) std::rethrow_exception(failure);
+}
+
+class ThreadPool
+	// Persistent workers for loops that run too often to start threads for,
+	// like per-frame work in the editor. run() behaves like parallel_for.
+{
+	std::mutex mutex;
+	std::condition_variable wake, idle;
+	std::function<void(size_t)> job;
+	size_t size = 0, failed_at = 0;
+	std::atomic<size_t> next{0};
+	std::exception_ptr failure;
+	size_t generation = 0, running = 0;
+	bool stopping = false;
+	vector<std::thread> workers;
+
+	void work()
+	{
+		for (size_t i; (i = next++) < size; )
+			try { job(i); }
+			catch (...)
+			{
+				std::lock_guard<std::mutex> const lock(mutex);
+				if (i < failed_at) { failed_at = i; failure = std::current_exception(); }
+				next = size;
+			}
+	}
+
+	void serve()
+	{
+		size_t seen = 0;
+		std::unique_lock<std::mutex> lock(mutex);
+
+		for (;;)
+		{
+			wake.wait(lock, [&]{ return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+
+			lock.unlock();
+			work();
+			lock.lock();
+
+			if (--running == 0) idle.notify_one();
+		}
+	}
+
+public:
+
+	explicit ThreadPool(size_t const threads = std::max(1u, std::thread::hardware_concurrency()))
+	{
+		for (size_t t = 1; t < threads; ++t) workers.emplace_back([this]{ serve(); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> const lock(mutex);
+			stopping = true;
+		}
+
+		wake.notify_all();
+		foreach (t : workers) t.join();
+	}
+
+	template<typename F>
+	void run(size_t const n, F const & f)
+		// calls f(i) for every i in [0, n) on the workers and the calling thread
+	{
+		if (workers.empty() || n <= 1)
+		{
+			for (size_t i = 0; i != n; ++i) f(i);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> const lock(mutex);
+			job = [&f](size_t const i){ f(i); };
+			size = n;
+			next = 0;
+			failed_at = n;
+			failure = nullptr;
+			running = workers.size();
+			++generation;
+		}
+
+		wake.notify_all();
+		work();
+
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [&]{ return running == 0; });
+		job = nullptr;
+
+		if (failure) std::rethrow_exception(failure);
+	}
+
+	ThreadPool(ThreadPool const &) = delete;
+	ThreadPool & operator=(ThreadPool const &) = delete;
+};
+
+template<typename T>
+class BoundedQueue
+	// Hands items from one thread to another, making the producer wait
+	// rather than letting the queue grow beyond its capacity.
+{
+	std::mutex mutex;
+	std::condition_variable not_full, not_empty;
+	std::deque<T> items;
+	size_t const capacity;
+	bool closed = false;
+
+public:
+
+	explicit BoundedQueue(size_t const c): capacity(std::max<size_t>(1, c)) {}
+
+	bool push(T x)
+		// returns false if the queue was closed, in which case x is dropped
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [&]{ return closed || items.size() < capacity; });
+		if (closed) return false;
+		items.push_back(move(x));
+		not_empty.notify_one();
+		return true;
+	}
+
+	optional<T> pop()
+		// none once the queue is closed and empty
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [&]{ return closed || !items.empty(); });
+		if (items.empty()) return none;
+		optional<T> x(move(items.front()));
+		items.pop_front();
+		not_full.notify_one();
+		return x;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> const lock(mutex);
+		closed = true;
+		not_full.notify_all();
+		not_empty.notify_all();
+	}
+
+	BoundedQueue(BoundedQueue const &) = delete;
+	BoundedQueue & operator=(BoundedQueue const &) = delete;
+};
+
+}
+
+#endif
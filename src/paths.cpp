@@ -38,7 +38,7 @@ Frames frames(Graph const & g, Path const & path, unsigned const frames_per_pos)
 	foreach (step : path)
 	{
 		pair<vector<Position>, ReorientedNode> p =
-			follow(g, n, step.seq, frames_per_pos / (is_detailed(g[step.seq]) ? 2 : 1));
+			follow(g, n, step.seq, frames_per_pos / (is_detailed(g, step.seq) ? 2 : 1));
 
 		p.first.pop_back();
 
@@ -135,7 +135,7 @@ public:
 		: graph(g)
 	{
 		foreach(n : nodenums(g))
-			standing.push_back(tags(g[n]).count("standing") != 0);
+			standing.push_back(is_tagged(g, "standing", n));
 	}
 
 	Path find(ReorientedNode const n, size_t const size)
@@ -204,12 +204,12 @@ Path randomScene(Graph const & g, NodeNum const start, size_t const size)
 			worst_seq = x.seq;
 		}
 	}
-	std::cout << ss.size() << " unique sequences\n";
+	std::cerr << ss.size() << " unique sequences\n";
 
 	if (!ss.empty())
 	{
 		auto & p = *ss.rbegin();
-		std::cout << "worst: " << worst_seq.index << " occurs " << worst_count << " times\n";
+		std::cerr << "worst: " << worst_seq.index << " occurs " << worst_count << " times\n";
 	}
 
 	return s;
@@ -226,43 +226,62 @@ Scene randomScene(Graph const & g, NodeNum const start, size_t const size)
 }
 */
 
-vector<Path> paths_through(Graph const & g, Step s, unsigned in_size, unsigned out_size)
+bool foreach_path_through(Graph const & g, Step const s, unsigned const in_size, unsigned const out_size, PathCallback const & f)
 {
-	vector<Path> v;
+	Path path;
 
-	foreach (pre : in_paths(g, from(g, s).node, in_size))
-	foreach (post : out_paths(g, to(g, s).node, out_size))
-	{
-		Path path = pre;
-		path.push_back(s);
-		append(path, post);
-		v.push_back(path);
-	}
+	return foreach_in_path(g, from(g, s).node, in_size, [&](Path const & pre)
+		{
+			return foreach_out_path(g, to(g, s).node, out_size, [&](Path const & post)
+				{
+					path = pre;
+					path.push_back(s);
+					append(path, post);
+					return f(path);
+				});
+		});
+}
 
+vector<Path> paths_through(Graph const & g, Step s, unsigned in_size, unsigned out_size)
+{
+	vector<Path> v;
+	foreach_path_through(g, s, in_size, out_size, [&](Path const & p) { v.push_back(p); return true; });
 	return v;
 }
 
-Frames demoFrames(Graph const & g, Step const s, unsigned const frames_per_pos)
+void demoFrames(Graph const & g, Step const s, unsigned const frames_per_pos,
+	optional<size_t> const max_scenes, std::function<bool(Frames const &)> const & play)
 {
-	Frames f;
+	unsigned const in_size = 1, out_size = 4;
 
-	auto scenes = paths_through(g, s, 1, 4);
+	size_t total = 0;
+	foreach_path_through(g, s, in_size, out_size, [&](Path const &) { ++total; return true; });
 
-	cout << "Generating " << scenes.size() << " demo scenes.\n";
+	size_t const wanted = max_scenes ? std::min(*max_scenes, total) : total;
 
-	foreach (scene : scenes)
-	{
-		Frames z = frames(g, scene, frames_per_pos);
+	std::cerr << "Generating " << wanted << " of " << total << " demo scenes.\n";
 
-		Position const last = z.back().second.back();
-		z.back().second.insert(z.back().second.end(), 70, last);
+	size_t seen = 0, chosen = 0;
 
-		Frames const x = smoothen(z);
-		f.push_back({"      ", vector<Position>(70, x.front().second.front())});
-		append(f, x);
-	}
+	foreach_path_through(g, s, in_size, out_size, [&](Path const & scene)
+		{
+			if (chosen == wanted) return false;
 
-	return f;
+			if (wanted != total && size_t(rand()) % (total - seen++) >= wanted - chosen) return true;
+				// selection sampling: every subset of the wanted size is equally likely
+			++chosen;
+
+			Frames z = frames(g, scene, frames_per_pos);
+
+			Position const last = z.back().second.back();
+			z.back().second.insert(z.back().second.end(), 70, last);
+
+			Frames const x = smoothen(z);
+			Frames f{{"      ", vector<Position>(70, x.front().second.front())}};
+			append(f, x);
+
+			return play(f);
+		});
 }
 
 }
@@ -15,9 +15,14 @@ namespace GrappleMap
 
 	Path randomScene(Graph const &, NodeNum start, size_t);
 
+	bool foreach_path_through(Graph const &, Step, unsigned in_size, unsigned out_size, PathCallback const &);
+
 	vector<Path> paths_through(Graph const &, Step, unsigned in_size, unsigned out_size);
 
-	Frames demoFrames(Graph const &, Step, unsigned frames_per_pos);
+	void demoFrames(Graph const &, Step, unsigned frames_per_pos, optional<size_t> max_scenes,
+		std::function<bool(Frames const &)> const & play);
+			// Calls play with the frames of each chain through the step as soon as they are made,
+			// until it returns false. With max_scenes, plays a random sample (see std::srand) of that many.
 }
 
 #endif
@@ -1,9 +1,17 @@
 #include "persistence.hpp"
 #include "graph_util.hpp"
+#include "parallel.hpp"
+#include "distances.hpp"
 #include <fstream>
 #include <iterator>
 #include <cstring>
-#include <boost/algorithm/string/trim.hpp>
+#include <sstream>
+#include <iomanip>
+#include <boost/uuid/detail/md5.hpp>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
 
 namespace GrappleMap {
 
@@ -12,55 +20,132 @@ namespace
 	char const base62digits[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
 	static_assert(sizeof(base62digits) == 62 + 1, "hm");
 
-	int fromBase62(char c)
-	{
-		if (c >= 'a' && c <= 'z') return c - 'a';
-		if (c >= 'A' && c <= 'Z') return (c - 'A') + 26;
-		if (c >= '0' && c <= '9') return (c - '0') + 52;
-
-		throw std::runtime_error("not a base 62 digit: " + std::string(1, c));
-	}
-
 	string desc(Graph::Node const & n) // TODO: bad, tojs should not alter description strings
 	{
 		auto desc = n.description;
 		return desc.empty() ? "?" : desc.front();
 	}
 
-	Position decodePosition(string s)
+	size_t const position_chars = 2 * joint_count * 3 * 2;
+
+	struct Base62Table
 	{
-		if (s.size() != 2 * joint_count * 3 * 2)
-			error("position string has incorrect size " + to_string(s.size()));
+		int8_t value[256];
+
+		Base62Table()
+		{
+			std::fill(std::begin(value), std::end(value), -1);
+			for (int i = 0; i != 62; ++i) value[uint8_t(base62digits[i])] = i;
+		}
+	};
+
+	Base62Table const base62;
 
-		auto g = [&s]
+	#ifdef __SSE2__
+	bool decode16(char const * const s, uint16_t * const out)
+		// Decodes 16 base 62 digits into 8 numbers, each being first digit * 62 + second digit.
+		// Returns false if any of the characters is not a base 62 digit.
+	{
+		__m128i const c = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s));
+
+		auto in_range = [c](char const lo, char const hi)
 			{
-				double d = double(fromBase62(s[0]) * 62 + fromBase62(s[1])) / 1000;
-				s.erase(0, 2);
-				return d;
+				return _mm_and_si128(
+					_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+					_mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
 			};
 
+		__m128i const lower = in_range('a', 'z'), upper = in_range('A', 'Z'), digit = in_range('0', '9');
+
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(lower, upper), digit)) != 0xffff)
+			return false;
+
+		__m128i const v = _mm_or_si128(_mm_or_si128(
+			_mm_and_si128(lower, _mm_sub_epi8(c, _mm_set1_epi8('a'))),
+			_mm_and_si128(upper, _mm_sub_epi8(c, _mm_set1_epi8('A' - 26)))),
+			_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0' - 52))));
+
+		__m128i const first = _mm_and_si128(v, _mm_set1_epi16(0xff));
+		__m128i const second = _mm_srli_epi16(v, 8);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+			_mm_add_epi16(_mm_mullo_epi16(first, _mm_set1_epi16(62)), second));
+
+		return true;
+	}
+	#endif
+
+	Position decodePosition(char const * const s) // reads position_chars characters
+	{
+		uint16_t v[position_chars / 2];
+		size_t i = 0;
+
+		#ifdef __SSE2__
+			for (; i + 16 <= position_chars; i += 16)
+				if (!decode16(s + i, v + i / 2)) break;
+		#endif
+
+		for (; i != position_chars; ++i)
+		{
+			int const d = base62.value[uint8_t(s[i])];
+			if (d < 0) error("not a base 62 digit: " + string(1, s[i]));
+			if (i % 2 == 0) v[i / 2] = d * 62; else v[i / 2] += d;
+		}
+
 		Position p;
+		uint16_t const * d = v;
 
 		foreach (j : playerJoints)
-			p[j] = {g() - 2, g(), g() - 2};
+		{
+			p[j] = {double(d[0]) / 1000 - 2, double(d[1]) / 1000, double(d[2]) / 1000 - 2};
+			d += 3;
+		}
 
 		return p;
 	}
 
-	istream & operator>>(istream & i, vector<Sequence> & v)
+	void append_trimmed(string & s, char const * b, char const * e)
 	{
-		string line;
+		auto space = [](char const c){ return c == ' ' || (c >= '\t' && c <= '\r'); };
+
+		while (b != e && space(*b)) ++b;
+		while (b != e && space(e[-1])) --e;
+		s.append(b, e);
+	}
+
+	vector<Sequence> readSequences(string const & text)
+		// Splitting into lines and sequences is done sequentially, after which
+		// the positions of each sequence are decoded in parallel.
+	{
+		vector<Sequence> v;
+		vector<string> digits; // per sequence, its trimmed position lines concatenated
+		vector<vector<unsigned>> position_line_nrs; // per sequence, the last line of each position
+
 		vector<string> desc;
 		bool last_was_position = false;
 
 		unsigned line_nr = 0;
 
+		char const * i = text.data();
+		char const * const end = i + text.size();
+		char const * b;
+		char const * e;
+
+		auto getline = [&]
+			{
+				if (i == end) return false;
+				b = i;
+				e = std::find(i, end, '\n');
+				i = (e == end ? end : e + 1);
+				return true;
+			};
+
 		try
 		{
-			while (std::getline(i, line))
+			while (getline())
 			{
 				++line_nr;
-				bool const is_position = line.front() == ' ';
+				bool const is_position = b != e && *b == ' ';
 
 				if (is_position)
 				{
@@ -68,36 +153,52 @@ namespace
 					{
 						assert(!desc.empty());
 						v.push_back(Sequence{desc, vector<Position>{}, line_nr - desc.size()});
+						digits.emplace_back();
+						position_line_nrs.emplace_back();
 						desc.clear();
 					}
 
-					boost::algorithm::trim(line);
+					string & d = digits.back();
+					size_t const start = d.size();
+
+					append_trimmed(d, b, e);
 
 					for (int j = 0; j != 3; ++j)
 					{
 						++line_nr;
-						string more;
-						if (!std::getline(i, more))
+						if (!getline())
 							error("could not read position at line " + to_string(line_nr));
-						boost::algorithm::trim(more);
-						line += more;
+						append_trimmed(d, b, e);
 					}
 
-					if (v.empty()) error("malformed file");
+					if (d.size() - start != position_chars)
+						error("position string has incorrect size " + to_string(d.size() - start));
 
-					v.back().positions.push_back(decodePosition(line));
+					position_line_nrs.back().push_back(line_nr);
 				}
-				else desc.push_back(line);
+				else desc.emplace_back(b, e);
 
 				last_was_position = is_position;
 			}
-
-			return i;
 		}
-		catch (exception const & e)
+		catch (exception const & x)
 		{
-			error("at line " + to_string(line_nr) + ": " + e.what());
+			error("at line " + to_string(line_nr) + ": " + x.what());
 		}
+
+		parallel_for(v.size(), [&](size_t const s)
+			{
+				auto const & line_nrs = position_line_nrs[s];
+				auto & positions = v[s].positions;
+
+				positions.reserve(line_nrs.size());
+
+				for (size_t p = 0; p != line_nrs.size(); ++p)
+					try { positions.push_back(decodePosition(digits[s].data() + p * position_chars)); }
+					catch (exception const & x) { error("at line " + to_string(line_nrs[p]) + ": " + x.what()); }
+			});
+
+		return v;
 	}
 
 	ostream & operator<<(ostream & o, Position const & p)
@@ -138,12 +239,21 @@ namespace
 
 Graph loadGraph(string const filename)
 {
-	std::vector<Sequence> edges;
+	if (is_binary_db(filename)) return loadBinaryGraph(filename);
+
 	std::ifstream ff(filename, std::ios::binary);
 
 	if (!ff) error(filename + ": " + std::strerror(errno));
 
-	ff >> edges;
+	string text;
+	ff.seekg(0, std::ios::end);
+	text.resize(ff.tellg());
+	ff.seekg(0);
+	ff.read(&text[0], text.size());
+
+	if (!ff) error(filename + ": read failed");
+
+	std::vector<Sequence> edges = readSequences(text);
 
 	// nodes have been read as sequences of size 1
 
@@ -162,21 +272,214 @@ Graph loadGraph(string const filename)
 	return Graph(nodes, edges);
 }
 
+namespace
+{
+	void write(ostream & o, Graph::Node const & n)
+	{
+		if (!n.description.empty())
+		{
+			foreach (l : n.description) o << l << '\n';
+			o << n.position;
+		}
+	}
+
+	void write(ostream & o, Sequence const & s) { o << s; }
+
+	template<typename Digest>
+	string hex(Digest const & digest)
+		// Boost's md5 digest is either 16 bytes, or (in older versions) 4 words
+		// that are printed whole, because their bytes are in the wrong order
+	{
+		std::ostringstream o;
+		o << std::hex << std::setfill('0');
+		foreach (x : digest) o << std::setw(sizeof x * 2) << unsigned(x);
+		return o.str();
+	}
+
+	void replace_file(string const & from, string const & to)
+	{
+		#ifdef _WIN32
+			std::remove(to.c_str()); // rename does not overwrite on Windows
+		#endif
+
+		if (std::rename(from.c_str(), to.c_str()) != 0)
+			error("could not rename " + from + " to " + to + ": " + std::strerror(errno));
+	}
+}
+
 void save(Graph const & g, string const filename)
 {
 	std::ofstream f(filename, std::ios::binary);
 
-	foreach(n : nodenums(g))
-		if (!g[n].description.empty())
+	foreach(n : nodenums(g)) write(f, g[n]);
+	foreach(s : seqnums(g)) f << g[s];
+}
+
+IncrementalSaver::IncrementalSaver(string const f)
+	: filename(f), binary(is_binary_db(f))
+{}
+
+IncrementalSaver::~IncrementalSaver()
+{
+	if (pending.valid()) pending.wait();
+}
+
+void IncrementalSaver::save(Graph const & g)
+{
+	if (pending.valid()) pending.wait(); // so that the cache is ours again
+
+	if (binary)
+	{
+		pending = std::async(std::launch::async, [this, copy = g]
+			{
+				try
+				{
+					string const tmp = filename + ".tmp";
+					saveBinary(copy, tmp);
+					replace_file(tmp, filename);
+
+					std::cerr << "Saved " << filename << " (binary)" << std::endl;
+				}
+				catch (exception const & e)
+				{
+					std::cerr << "Could not save " << filename << ": " << e.what() << std::endl;
+				}
+			});
+
+		return;
+	}
+
+	struct Record
+	{
+		uint64_t stamp;
+		std::shared_ptr<string const> text;
+		std::function<void(ostream &)> write; // for records not in the cache
+	};
+
+	vector<Record> records;
+	records.reserve(g.num_nodes() + g.num_sequences());
+
+	auto add = [&](uint64_t const stamp, auto const & data)
 		{
-			foreach (l : g[n].description) f << l << '\n';
-			f << g[n].position;
-		}
+			auto const i = cache.find(stamp);
 
-	foreach(s : seqnums(g)) f << g[s];
+			if (i != cache.end())
+				records.push_back(Record{stamp, i->second, nullptr});
+			else
+				records.push_back(Record{stamp, nullptr,
+					[data](ostream & o){ write(o, data); }});
+		};
+
+	foreach (n : nodenums(g)) add(g.stamp(n), g[n]);
+	foreach (s : seqnums(g)) add(g.stamp(s), g[s]);
+
+	pending = std::async(std::launch::async, [this, records = move(records)]() mutable
+		{
+			try
+			{
+				map<uint64_t, std::shared_ptr<string const>> new_cache;
+				unsigned serialized = 0;
+
+				foreach (r : records)
+				{
+					if (!r.text)
+					{
+						std::ostringstream o;
+						r.write(o);
+						r.text = std::make_shared<string const>(o.str());
+						++serialized;
+					}
+
+					new_cache.emplace(r.stamp, r.text);
+				}
+
+				string const tmp = filename + ".tmp";
+
+				{
+					std::ofstream f(tmp, std::ios::binary);
+					foreach (r : records) f << *r.text;
+					f.close();
+					if (!f) error(tmp + ": write failed");
+				}
+
+				replace_file(tmp, filename);
+
+				cache = move(new_cache);
+
+				std::cerr << "Saved " << filename << " (" << serialized << " of "
+					<< records.size() << " records reserialized)" << std::endl;
+			}
+			catch (exception const & e)
+			{
+				std::cerr << "Could not save " << filename << ": " << e.what() << std::endl;
+			}
+		});
 }
 
-Path readScene(Graph const & graph, string const filename)
+string md5(string const & bytes)
+{
+	boost::uuids::detail::md5 h;
+	h.process_bytes(bytes.data(), bytes.size());
+	boost::uuids::detail::md5::digest_type d;
+	h.get_digest(d);
+	return hex(d);
+}
+
+string md5_of_file(string const filename)
+{
+	std::ifstream f(filename, std::ios::binary);
+	if (!f) error(filename + ": " + std::strerror(errno));
+
+	boost::uuids::detail::md5 h;
+	char buf[1 << 16];
+
+	while (f.read(buf, sizeof buf) || f.gcount())
+		h.process_bytes(buf, f.gcount());
+
+	if (f.bad()) error(filename + ": read failed");
+
+	boost::uuids::detail::md5::digest_type d;
+	h.get_digest(d);
+	return hex(d);
+}
+
+Manifest loadManifest(string const filename)
+{
+	Manifest m;
+
+	std::ifstream f(filename);
+	if (!f) return m;
+
+	string word;
+	if (!(f >> word) || word != "source" || !(f >> m.source))
+		error(filename + ": not a manifest");
+
+	Manifest::Output o;
+	string path;
+
+	while (f >> o.inputs >> o.content && std::getline(f >> std::ws, path))
+		m.outputs[path] = o;
+
+	return m;
+}
+
+void save(Manifest const & m, string const filename)
+{
+	string const tmp = filename + ".tmp";
+
+	{
+		std::ofstream f(tmp, std::ios::binary);
+		f << "source " << m.source << '\n';
+		foreach (o : m.outputs)
+			f << o.second.inputs << ' ' << o.second.content << ' ' << o.first << '\n';
+		f.close();
+		if (!f) error(tmp + ": write failed");
+	}
+
+	replace_file(tmp, filename);
+}
+
+Path readScene(Graph const & graph, string const filename, Distances const * const distances, optional<PathCost> const fill_gaps)
 {
 	std::ifstream f(filename, std::ios::binary);
 	if (!f) error(filename + ": " + std::strerror(errno));
@@ -194,14 +497,37 @@ Path readScene(Graph const & graph, string const filename)
 			{
 				if (prev_node)
 				{
-					foreach (step : out_steps(graph, *prev_node))
+					NodeNum const prev = *prev_node;
+
+					foreach (step : out_steps(graph, prev))
 						if (to(graph, step).node == *n)
 						{
 							path.push_back(step);
 							goto found;
 						}
 
-					error("could not find transition");
+					if (fill_gaps)
+						if (optional<Path> const gap = cheapest_path(graph, prev, *n, *fill_gaps))
+						{
+							append(path, *gap);
+							goto found;
+						}
+
+					{
+						string msg = "could not find transition";
+
+						if (distances)
+						{
+							if (optional<Path> const route = distances->shortest_path(graph, prev, *n))
+							{
+								msg += "; the shortest route takes " + to_string(route->size()) + ":";
+								foreach (step : *route) msg += "\n\t" + replace_all(graph[step.seq].description.front(), "\\n", " ");
+							}
+							else msg += "; there is no route at all";
+						}
+
+						error(msg);
+					}
 
 					found:;
 				}
@@ -213,6 +539,20 @@ Path readScene(Graph const & graph, string const filename)
 				path.push_back(*step);
 				prev_node = to(graph, *step).node;
 			}
+			else if (fill_gaps && prev_node)
+			{
+				// a transition that doesn't start where the previous line ended
+
+				optional<Step> const step = step_by_desc(graph, desc);
+				if (!step) error("unknown: \"" + desc + '"');
+
+				optional<Path> const gap = cheapest_path(graph, *prev_node, from(graph, *step).node, *fill_gaps);
+				if (!gap) error("no route to the start of \"" + desc + '"');
+
+				append(path, *gap);
+				path.push_back(*step);
+				prev_node = to(graph, *step).node;
+			}
 			else error("unknown: \"" + desc + '"');
 		}
 		catch (std::exception const & e)
@@ -260,12 +600,12 @@ void todot(Graph const & graph, std::ostream & o, std::map<NodeNum, bool /* high
 		o << from.index << " -> " << to.index
 		  << " [label=\"" << (d == "..." ? "" : d) << "\"";
 
-		if (is_top_move(graph[s]))
+		if (is_top_move(graph, s))
 			o << ",color=red";
-		else if (is_bottom_move(graph[s]))
+		else if (is_bottom_move(graph, s))
 			o << ",color=blue";
 
-		if (is_bidirectional(graph[s]))
+		if (is_bidirectional(graph, s))
 			o << ",dir=\"both\"";
 
 		o << "];\n";
@@ -366,7 +706,7 @@ void tojs(Graph const & graph, std::ostream & js)
 		tojs(graph[n].position, js);
 		js << ",description:'" << replace_all(desc(graph[n]), "'", "\\'") << "'";
 		js << ",tags:";
-		tojs(tags(graph[n]), js);
+		tojs(tags(graph, n), js);
 		js << ",discriminators:";
 		tojs(disc, js);
 		js << "},\n";
@@ -390,9 +730,9 @@ void tojs(Graph const & graph, std::ostream & js)
 		js << "],description:";
 		tojs(seq.description, js);
 		js << ",tags:";
-		tojs(tags(seq), js);
+		tojs(tags(graph, s), js);
 		js << ",properties:";
-		tojs(properties_in_desc(seq.description), js);
+		tojs(properties(graph, s), js);
 		if (seq.line_nr)
 			js << ",line_nr:" << *seq.line_nr;
 		js << "},\n";
@@ -2,12 +2,64 @@
 #define GRAPPLEMAP_PERSISTENCE_HPP
 
 #include "graph_util.hpp"
+#include <functional>
+#include <future>
+#include <memory>
 
 namespace GrappleMap
 {
-	Graph loadGraph(string filename);
+	class Distances;
+
+	Graph loadGraph(string filename); // accepts both text and binary databases
 	void save(Graph const &, string filename);
-	Path readScene(Graph const &, string filename);
+
+	bool is_binary_db(string filename);
+	Graph loadBinaryGraph(string filename);
+	void saveBinary(Graph const &, string filename);
+
+	class IncrementalSaver
+		// Saves on a background thread, writing to a temporary file that then replaces the
+		// database, in the format the database was in when the saver was made. In the text
+		// format, nodes and sequences whose stamp has not changed since the previous save
+		// are not serialized again.
+	{
+		string const filename;
+		bool const binary;
+		map<uint64_t, std::shared_ptr<string const>> cache; // by stamp, only touched by the task
+		std::future<void> pending;
+
+	public:
+
+		explicit IncrementalSaver(string filename);
+		~IncrementalSaver(); // waits for a pending save
+
+		IncrementalSaver(IncrementalSaver const &) = delete;
+		IncrementalSaver & operator=(IncrementalSaver const &) = delete;
+
+		void save(Graph const &);
+			// only copies changed nodes and sequences before returning (all of them for binary)
+	};
+
+	string md5(string const & bytes); // lowercase hex, like md5sum
+	string md5_of_file(string filename);
+
+	struct Manifest
+		// What a previous run of a generator made: for each output file, by path relative
+		// to the manifest, digests of what it was made from and of its contents.
+	{
+		struct Output { string inputs, content; };
+
+		string source; // digest of the database and options the run used
+		map<string, Output> outputs;
+	};
+
+	Manifest loadManifest(string filename); // empty if there is no such file
+	void save(Manifest const &, string filename); // atomically
+
+	Path readScene(Graph const &, string filename, Distances const * = nullptr, optional<PathCost> fill_gaps = none);
+		// Each line names a position or a transition. Consecutive lines must be directly connected,
+		// unless fill_gaps is given, in which case the cheapest connecting path is inserted.
+		// With distances, errors about unconnected lines suggest the shortest route.
 	void todot(Graph const &, std::ostream &, std::map<NodeNum, bool /* highlight */> const &, char heading);
 	void tojs(PositionReorientation const &, std::ostream &);
 	void tojs(Graph const &, std::ostream &);
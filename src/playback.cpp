@@ -6,6 +6,7 @@
 #include "rendering.hpp"
 #include "graph_util.hpp"
 #include "paths.hpp"
+#include "distances.hpp"
 #include <unistd.h>
 #include <GLFW/glfw3.h>
 #include <GL/glu.h>
@@ -20,10 +21,13 @@ struct Config
 {
 	string db;
 	string script;
+	optional<PathCost> fill_gaps;
+	bool cache_distances;
 	unsigned frames_per_pos;
 	unsigned num_transitions;
 	string start;
 	optional<string /* desc */> demo;
+	optional<size_t> demo_limit;
 	optional<pair<unsigned, unsigned>> dimensions;
 	optional<string> dump;
 	optional<uint32_t> seed;
@@ -38,13 +42,17 @@ optional<Config> config_from_args(int const argc, char const * const * const arg
 			"number of frames rendered per position")
 		("script", po::value<string>()->default_value(string()),
 			"script file")
+		("fill-gaps", po::value<string>(),
+			"let script lines skip ahead, filling in the path with the fewest \"transitions\" or \"frames\"")
+		("cache-distances", "keep the table that script errors suggest routes from in <db>.distances")
 		("start", po::value<string>()->default_value("staredown"), "initial position")
 		("length", po::value<unsigned>()->default_value(50), "number of transitions")
 		("dimensions", po::value<string>(), "window dimensions")
 		("dump", po::value<string>(), "file to write sequence data to")
 		("seed", po::value<uint32_t>(), "PRNG seed")
 		("db", po::value<string>()->default_value("GrappleMap.txt"), "database file")
-		("demo", po::value<string>(), "show all chains of three transitions that have the given transition in the middle");
+		("demo", po::value<string>(), "show all chains of three transitions that have the given transition in the middle")
+		("demo-limit", po::value<size_t>(), "show only this many of those chains, picked at random");
 
 	po::variables_map vm;
 	po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -52,6 +60,9 @@ optional<Config> config_from_args(int const argc, char const * const * const arg
 
 	if (vm.count("help")) { cout << desc << '\n'; return none; }
 
+	if (vm.count("demo-limit") && vm["demo-limit"].as<size_t>() == 0)
+		throw runtime_error("--demo-limit must be at least 1");
+
 	optional<pair<unsigned, unsigned>> dimensions;
 	if (vm.count("dimensions"))
 	{
@@ -64,10 +75,13 @@ optional<Config> config_from_args(int const argc, char const * const * const arg
 	return Config
 		{ vm["db"].as<string>()
 		, vm["script"].as<string>()
+		, vm.count("fill-gaps") ? optional<PathCost>(path_cost(vm["fill-gaps"].as<string>())) : boost::none
+		, vm.count("cache-distances") != 0
 		, vm["frames-per-pos"].as<unsigned>()
 		, vm["length"].as<unsigned>()
 		, vm["start"].as<string>()
 		, optionalopt<string>(vm, "demo")
+		, optionalopt<size_t>(vm, "demo-limit")
 		, dimensions
 		, optionalopt<string>(vm, "dump")
 		, optionalopt<uint32_t>(vm, "seed")
@@ -88,19 +102,24 @@ void dump(std::ostream & o, PerJoint<V3> const & p)
 }
 
 
-Frames prep_frames(
+void prep_frames(
 	Config const & config,
-	Graph const & graph)
+	Graph const & graph,
+	std::function<bool(Frames const &)> const & play)
+		// calls play once, or once per scene in demo mode until it returns false
 {
 	if (config.demo)
 	{
 		if (auto step = step_by_desc(graph, *config.demo))
-			return demoFrames(graph, *step, config.frames_per_pos);
+			demoFrames(graph, *step, config.frames_per_pos, config.demo_limit, play);
 		else
 			throw runtime_error("no such transition: " + *config.demo);
 	}
 	else if (!config.script.empty())
-		return smoothen(frames(graph, readScene(graph, config.script), config.frames_per_pos));
+	{
+		Distances const distances = config.cache_distances ? loadDistances(graph, config.db) : Distances(graph);
+		play(smoothen(frames(graph, readScene(graph, config.script, &distances, config.fill_gaps), config.frames_per_pos)));
+	}
 	else if (optional<NodeNum> start = node_by_desc(graph, config.start))
 	{
 		Frames x = frames(graph, randomScene(graph, *start, config.num_transitions), config.frames_per_pos);
@@ -112,7 +131,7 @@ Frames prep_frames(
 		v.insert(v.begin(), config.frames_per_pos * 5, firstpos);
 		w.insert(w.end(), config.frames_per_pos * 15, lastpos);
 
-		return smoothen(x);
+		play(smoothen(x));
 	}
 	else
 		throw runtime_error("no such position/transition: " + config.start);
@@ -126,77 +145,88 @@ void do_playback(
 {
 	for (;;)
 	{
-		Frames const fr = prep_frames(config, graph);
-
 		Camera camera;
 		Style style;
 		style.background_color = white;
 		style.grid_size = 20;
 		style.grid_color = V3{.7, .7, .7};
 		camera.zoom(1.2);
-		camera.hardSetOffset(cameraOffsetFor(fr.front().second.front()));
 
 		string const separator = "      ";
 
-		for (auto i = fr.begin(); i != fr.end(); ++i)
-		{
-			#ifdef USE_FTGL
-				double const textwidth = style.font.Advance((i->first + separator).c_str(), -1);
-				V2 textpos{10,20};
-
-				string caption = i->first;
-				for (auto j = i+1; j != i + std::min(fr.end() - i, 6l); ++j)
-					caption += separator + j->first;
-			#endif
+		bool first = true, closed = false;
 
-			foreach (pos : i->second)
+		prep_frames(config, graph, [&](Frames const & fr)
+		{
+			if (first)
 			{
-				glfwPollEvents();
-				if (glfwWindowShouldClose(window)) return;
-
-				camera.rotateHorizontal(-0.013);
-				camera.setOffset(cameraOffsetFor(pos));
+				camera.hardSetOffset(cameraOffsetFor(fr.front().second.front()));
+				first = false;
+			}
 
-				if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) camera.rotateVertical(-0.05);
-				if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) camera.rotateVertical(0.05);
-				if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) camera.rotateHorizontal(-0.03);
-				if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) camera.rotateHorizontal(0.03);
-				if (glfwGetKey(window, GLFW_KEY_HOME) == GLFW_PRESS) camera.zoom(-0.05);
-				if (glfwGetKey(window, GLFW_KEY_END) == GLFW_PRESS) camera.zoom(0.05);
+			for (auto i = fr.begin(); i != fr.end(); ++i)
+			{
+				#ifdef USE_FTGL
+					double const textwidth = style.font.Advance((i->first + separator).c_str(), -1);
+					V2 textpos{10,20};
 
-				int bottom = 0;
-				int width, height;
-				glfwGetFramebufferSize(window, &width, &height);
+					string caption = i->first;
+					for (auto j = i+1; j != i + std::min(fr.end() - i, 6l); ++j)
+						caption += separator + j->first;
+				#endif
 
-				if (config.dimensions)
+				foreach (pos : i->second)
 				{
-					width = config.dimensions->first;
-
-					bottom = height - config.dimensions->second;
-					height = config.dimensions->second;
+					glfwPollEvents();
+					if (glfwWindowShouldClose(window)) { closed = true; return false; }
+
+					camera.rotateHorizontal(-0.013);
+					camera.setOffset(cameraOffsetFor(pos));
+
+					if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) camera.rotateVertical(-0.05);
+					if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) camera.rotateVertical(0.05);
+					if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) camera.rotateHorizontal(-0.03);
+					if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) camera.rotateHorizontal(0.03);
+					if (glfwGetKey(window, GLFW_KEY_HOME) == GLFW_PRESS) camera.zoom(-0.05);
+					if (glfwGetKey(window, GLFW_KEY_END) == GLFW_PRESS) camera.zoom(0.05);
+
+					int bottom = 0;
+					int width, height;
+					glfwGetFramebufferSize(window, &width, &height);
+
+					if (config.dimensions)
+					{
+						width = config.dimensions->first;
+
+						bottom = height - config.dimensions->second;
+						height = config.dimensions->second;
+					}
+
+					renderWindow(
+						{{0, 0, 1, 1, none, 50}},
+		//				third_person_windows_in_corner(.3,.3,.01,.01 * (double(width)/height)),
+						nullptr, // no viables
+						graph, pos, camera,
+						none, // no highlighted joint
+						false, // not edit mode
+						0, bottom,
+						width, height, {0} /* todo */, style);
+
+					/*
+					#ifdef USE_FTGL
+						renderText(style.sequenceFont, textpos, caption, black);
+						textpos.x -= textwidth / (i->second.size()-1);
+					#endif
+					*/
+
+					glfwSwapBuffers(window);
 				}
-
-				renderWindow(
-					{{0, 0, 1, 1, none, 50}},
-	//				third_person_windows_in_corner(.3,.3,.01,.01 * (double(width)/height)),
-					nullptr, // no viables
-					graph, pos, camera,
-					none, // no highlighted joint
-					false, // not edit mode
-					0, bottom,
-					width, height, {0} /* todo */, style);
-
-				/*
-				#ifdef USE_FTGL
-					renderText(style.sequenceFont, textpos, caption, black);
-					textpos.x -= textwidth / (i->second.size()-1);
-				#endif
-				*/
-
-				glfwSwapBuffers(window);
 			}
 
-		}
+			return true;
+		});
+
+		if (closed) return;
 	}
 }
 
@@ -216,17 +246,21 @@ int main(int const argc, char const * const * const argv)
 
 		if (config->dump)
 		{
-			Frames const frames = prep_frames(*config, graph);
 			int n = 0;
 			std::ofstream f(*config->dump);
 
-			foreach (x : frames)
-			foreach (p : x.second)
+			prep_frames(*config, graph, [&](Frames const & frames)
 			{
-				dump(f, p[0]);
-				dump(f, p[1]);
-				++n;
-			}
+				foreach (x : frames)
+				foreach (p : x.second)
+				{
+					dump(f, p[0]);
+					dump(f, p[1]);
+					++n;
+				}
+
+				return true;
+			});
 
 			std::cout << "Wrote " << n << " frames to " << *config->dump << '\n';
 		}
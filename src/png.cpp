@@ -0,0 +1,200 @@
+#include "png.hpp"
+#include <zlib.h>
+#include <cstdio>
+#include <cstdlib>
+
+namespace GrappleMap {
+
+namespace
+{
+	size_t const bpp = 3; // bytes per pixel
+
+	void put32(string & out, uint32_t const v)
+	{
+		out += char(v >> 24);
+		out += char(v >> 16);
+		out += char(v >> 8);
+		out += char(v);
+	}
+
+	void chunk(string & out, char const * type, uint8_t const * data, size_t const size)
+	{
+		put32(out, size);
+		size_t const start = out.size();
+		out.append(type, 4);
+		if (size) out.append(reinterpret_cast<char const *>(data), size);
+		put32(out, crc32(0, reinterpret_cast<Bytef const *>(out.data() + start), size + 4));
+	}
+
+	uint8_t paeth(int const a, int const b, int const c)
+	{
+		int const p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+		return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+	}
+
+	void filter_row(int const type, uint8_t const * row, uint8_t const * prev, size_t const n, uint8_t * out)
+		// prev is a row of zeroes for the first row
+	{
+		switch (type)
+		{
+			case 0:
+				std::copy(row, row + n, out);
+				break;
+			case 1:
+				for (size_t i = 0; i != n; ++i) out[i] = row[i] - (i < bpp ? 0 : row[i - bpp]);
+				break;
+			case 2:
+				for (size_t i = 0; i != n; ++i) out[i] = row[i] - prev[i];
+				break;
+			case 3:
+				for (size_t i = 0; i != n; ++i) out[i] = row[i] - ((i < bpp ? 0 : row[i - bpp]) + prev[i]) / 2;
+				break;
+			case 4:
+				for (size_t i = 0; i != n; ++i)
+					out[i] = row[i] - (i < bpp
+						? paeth(0, prev[i], 0)
+						: paeth(row[i - bpp], prev[i], prev[i - bpp]));
+				break;
+		}
+	}
+
+	size_t cost(uint8_t const * const p, size_t const n)
+		// the usual heuristic: the sum of the bytes taken as signed
+	{
+		size_t c = 0;
+		for (size_t i = 0; i != n; ++i) c += std::abs(int(int8_t(p[i])));
+		return c;
+	}
+
+	class Encoder
+	{
+		z_stream z;
+		bool initialized = false;
+		int level = -1, strategy = -1;
+		vector<uint8_t> filtered, candidate, zeroes;
+		string compressed;
+
+		void prepare(int const l, int const s)
+		{
+			if (initialized && l == level && s == strategy)
+			{
+				deflateReset(&z);
+				return;
+			}
+
+			if (initialized) deflateEnd(&z);
+
+			z = z_stream();
+			if (deflateInit2(&z, l, Z_DEFLATED, 15, 9, s) != Z_OK)
+				error("deflateInit2 failed");
+
+			initialized = true;
+			level = l;
+			strategy = s;
+		}
+
+	public:
+
+		Encoder() = default;
+		~Encoder() { if (initialized) deflateEnd(&z); }
+
+		Encoder(Encoder const &) = delete;
+		Encoder & operator=(Encoder const &) = delete;
+
+		string encode(Image const & image, PngOptions const o)
+		{
+			size_t const n = size_t(image.width) * bpp; // bytes per row
+
+			filtered.resize((n + 1) * image.height);
+			candidate.resize(n);
+			zeroes.assign(n, 0);
+
+			uint8_t const * const pixels = reinterpret_cast<uint8_t const *>(image.pixels.data());
+
+			for (unsigned y = 0; y != image.height; ++y)
+			{
+				uint8_t const * const row = pixels + y * n;
+				uint8_t const * const prev = y ? row - n : zeroes.data();
+				uint8_t * const out = &filtered[y * (n + 1)];
+
+				if (o.filter != PngOptions::Adaptive)
+				{
+					int const type = o.filter == PngOptions::Sub ? 1 : o.filter == PngOptions::Up ? 2 : 0;
+					out[0] = type;
+					filter_row(type, row, prev, n, out + 1);
+					continue;
+				}
+
+				size_t best = size_t(-1);
+
+				for (int type = 0; type != 5; ++type)
+				{
+					filter_row(type, row, prev, n, candidate.data());
+					size_t const c = cost(candidate.data(), n);
+
+					if (c < best)
+					{
+						best = c;
+						out[0] = type;
+						std::copy(candidate.begin(), candidate.end(), out + 1);
+					}
+				}
+			}
+
+			prepare(o.level, o.rle ? Z_RLE : o.filter == PngOptions::NoFilter ? Z_DEFAULT_STRATEGY : Z_FILTERED);
+
+			compressed.resize(deflateBound(&z, filtered.size()));
+			z.next_in = filtered.data();
+			z.avail_in = filtered.size();
+			z.next_out = reinterpret_cast<Bytef *>(&compressed[0]);
+			z.avail_out = compressed.size();
+
+			if (deflate(&z, Z_FINISH) != Z_STREAM_END) error("deflate failed");
+
+			string out = "\x89PNG\r\n\x1a\n";
+
+			uint8_t ihdr[13] =
+				{ 0, 0, 0, 0, 0, 0, 0, 0
+				, 8 // bits per channel
+				, 2 // truecolor
+				, 0, 0, 0 }; // deflate, adaptive filtering, no interlace
+
+			for (int i = 0; i != 4; ++i)
+			{
+				ihdr[i] = image.width >> (24 - i * 8);
+				ihdr[4 + i] = image.height >> (24 - i * 8);
+			}
+
+			out.reserve(8 + 25 + z.total_out + 12 + 12);
+			chunk(out, "IHDR", ihdr, sizeof ihdr);
+			chunk(out, "IDAT", reinterpret_cast<uint8_t const *>(compressed.data()), z.total_out);
+			chunk(out, "IEND", nullptr, 0);
+
+			return out;
+		}
+	};
+}
+
+string encode_png(Image const & image, PngOptions const o)
+{
+	thread_local Encoder encoder;
+	return encoder.encode(image, o);
+}
+
+void write_png(Image const & image, string const & path, PngOptions const o)
+{
+	string const data = encode_png(image, o);
+	string const tmp = path + ".tmp";
+
+	{
+		std::ofstream f(tmp, std::ios::binary);
+		f.write(data.data(), data.size());
+		f.close();
+		if (!f) error("could not write to " + tmp);
+	}
+
+	if (std::rename(tmp.c_str(), path.c_str()) != 0)
+		error("could not rename " + tmp + " to " + path);
+}
+
+}
@@ -0,0 +1,31 @@
+#ifndef GRAPPLEMAP_PNG_HPP
+#define GRAPPLEMAP_PNG_HPP
+
+#include "image.hpp"
+
+namespace GrappleMap {
+
+struct PngOptions
+{
+	enum Filter { NoFilter, Sub, Up, Adaptive };
+		// Adaptive picks the best of PNG's five row filters for each row
+
+	int level; // zlib's, from 0 (stored) to 9 (smallest)
+	Filter filter;
+	bool rle; // run-length matches only, which suits flat renders and is much faster
+
+	static PngOptions fast() { return {1, Sub, true}; } // for frames that are encoded again
+	static PngOptions normal() { return {6, Adaptive, false}; } // like libpng's defaults
+	static PngOptions small() { return {9, Adaptive, false}; } // for published images
+};
+
+string encode_png(Image const &, PngOptions);
+	// 8-bit RGB, not interlaced. Each thread keeps its zlib stream and row buffers
+	// between calls.
+
+void write_png(Image const &, string const & path, PngOptions = PngOptions::normal());
+	// written to a temporary file that then replaces path
+
+}
+
+#endif
@@ -10,39 +10,101 @@ namespace GrappleMap {
 
 namespace
 {
-	void glNormal(V3 const & v) { ::glNormal3d(v.x, v.y, v.z); }
 	void glVertex(V3 const & v) { ::glVertex3d(v.x, v.y, v.z); }
 	void glTranslate(V3 const & v) { ::glTranslated(v.x, v.y, v.z); }
 	void glColor(V3 v) { ::glColor3d(v.x, v.y, v.z); }
 
-	void pillar(V3 from, V3 to, double from_radius, double to_radius, unsigned faces)
+	unsigned const pillar_faces = 30;
+
+	void compile_pillar(double const from_radius, double const to_radius)
+		// along z from 0 to 1
 	{
-		V3 a = normalize(cross(to - from, V3{1,1,1} - from));
-		V3 b = normalize(cross(to - from, a));
+		double const s = 2 * pi() / pillar_faces;
 
-		double s = 2 * pi() / faces;
+		auto normal = [&](unsigned const i) { glNormal3d(std::sin(i * s), std::cos(i * s), 0); };
+		auto vertex = [&](unsigned const i, double const r, double const z)
+			{ glVertex3d(r * std::sin(i * s), r * std::cos(i * s), z); };
 
 		glBegin(GL_TRIANGLES);
 
-		for (unsigned i = 0; i != faces; ++i)
+		for (unsigned i = 0; i != pillar_faces; ++i)
 		{
-			glNormal(a * sin(i * s) + b * cos(i * s));
-			glVertex(from + a * from_radius * std::sin( i    * s) + b * from_radius * std::cos( i    * s));
-			glVertex(to   + a *   to_radius * std::sin( i    * s) + b *   to_radius * std::cos( i    * s));
+			normal(i);
+			vertex(i, from_radius, 0);
+			vertex(i, to_radius, 1);
 
-			glNormal(a * sin((i + 1) * s) + b * cos((i + 1) * s));
-			glVertex(from + a * from_radius * std::sin((i+1) * s) + b * from_radius * std::cos((i+1) * s));
+			normal(i + 1);
+			vertex(i + 1, from_radius, 0);
 
-			glVertex(from + a * from_radius * std::sin((i+1) * s) + b * from_radius * std::cos((i+1) * s));
-			glVertex(to   + a *   to_radius * std::sin((i+1) * s) + b *   to_radius * std::cos((i+1) * s));
+			vertex(i + 1, from_radius, 0);
+			vertex(i + 1, to_radius, 1);
 
-			glNormal(a * sin(i * s) + b * cos(i * s));
-			glVertex(to   + a *   to_radius * std::sin( i    * s) + b *   to_radius * std::cos( i    * s));
+			normal(i);
+			vertex(i, to_radius, 1);
 		}
 
 		glEnd();
 	}
 
+	struct Meshes
+	{
+		GLuint pillars = 0;
+			// two per segment: from its first end to its midpoint, and from there to its second end
+		GLuint sphere = 0; // unit radius
+	};
+
+	Meshes const & meshes()
+		// Display lists belong to a GL context, and each thread renders into its own,
+		// so the lists are compiled once per thread, and again if its context was replaced.
+	{
+		thread_local Meshes m;
+
+		if (m.sphere && glIsList(m.sphere)) return m;
+
+		GLsizei const n = 2 * std::distance(std::begin(segments()), std::end(segments()));
+		m.pillars = glGenLists(n + 1);
+		m.sphere = m.pillars + n;
+
+		GLuint list = m.pillars;
+		foreach (s : segments())
+		{
+			glNewList(list++, GL_COMPILE);
+			compile_pillar(jointDefs[s.ends[0]].radius, s.midpointRadius);
+			glEndList();
+
+			glNewList(list++, GL_COMPILE);
+			compile_pillar(s.midpointRadius, jointDefs[s.ends[1]].radius);
+			glEndList();
+		}
+
+		GLUquadricObj * const quadric = gluNewQuadric();
+		glNewList(m.sphere, GL_COMPILE);
+		gluSphere(quadric, 1, 20, 20);
+		glEndList();
+		gluDeleteQuadric(quadric);
+
+		return m;
+	}
+
+	void pillar(GLuint const mesh, V3 const from, V3 const to)
+	{
+		V3 const d = to - from;
+		V3 const a = normalize(cross(d, V3{1,1,1} - from));
+		V3 const b = normalize(cross(d, a));
+
+		GLdouble const m[16] =
+			{ a.x, a.y, a.z, 0
+			, b.x, b.y, b.z, 0
+			, d.x, d.y, d.z, 0
+			, from.x, from.y, from.z, 1 };
+				// a and b are orthonormal and perpendicular to d, so normals come out unit length
+
+		glPushMatrix();
+		glMultMatrixd(m);
+		glCallList(mesh);
+		glPopMatrix();
+	}
+
 	void gluLookAt(V3 eye, V3 center, V3 up)
 	{
 		::gluLookAt(
@@ -72,6 +134,8 @@ namespace
 		optional<PlayerJoint> const highlight_joint,
 		optional<PlayerNum> const first_person_player, bool const edit_mode)
 	{
+		Meshes const & m = meshes();
+
 		// draw limbs:
 
 		for (PlayerNum p = 0; p != 2; ++p)
@@ -79,21 +143,27 @@ namespace
 			glColor(playerDefs[p].color);
 			Player const & player = pos[p];
 
-			foreach (s : segments())
-				if (s.visible)
-				{
-					auto const a = s.ends[0], b = s.ends[1];
+			GLuint mesh = m.pillars;
 
-					if (b == Head && p == first_person_player) continue;
+			foreach (s : segments())
+			{
+				auto const a = s.ends[0], b = s.ends[1];
 
+				if (s.visible && !(b == Head && p == first_person_player))
+				{
 					auto mid = (player[a] + player[b]) / 2;
-					pillar(player[a], mid, jointDefs[a].radius, s.midpointRadius, 30);
-					pillar(mid, player[b], s.midpointRadius, jointDefs[b].radius, 30);
+					pillar(mesh, player[a], mid);
+					pillar(mesh + 1, mid, player[b]);
 				}
+
+				mesh += 2;
+			}
 		}
 
 		// draw joints:
 
+		glEnable(GL_NORMALIZE);
+
 		foreach (pj : playerJoints)
 		{
 			if (pj.player == first_person_player && pj.joint == Head) continue;
@@ -113,12 +183,16 @@ namespace
 
 			glColor(color);
 
-			static GLUquadricObj * Sphere = gluNewQuadric(); // todo: evil
+			double const radius = jointDefs[pj.joint].radius + extraBig;
+
 			glPushMatrix();
 				glTranslate(pos[pj]);
-				gluSphere(Sphere, jointDefs[pj.joint].radius + extraBig, 20, 20);
+				glScaled(radius, radius, radius);
+				glCallList(m.sphere);
 			glPopMatrix();
 		}
+
+		glDisable(GL_NORMALIZE);
 	}
 
 	void drawViables(Graph const & graph, Viables const & viable, PlayerJoint const j, SeqNum const current_sequence,
@@ -127,12 +201,12 @@ namespace
 		foreach (v : viable[j].viables)
 		{
 
-			if (v.second.end - v.second.begin < 1) continue;
+			if (v.end - v.begin < 1) continue;
 
-			auto const r = v.second.reorientation;
-			auto & seq = graph[v.first].positions;
+			auto const r = v.reorientation;
+			auto & seq = graph[v.seqNum].positions;
 
-			if (v.second.seqNum == current_sequence)
+			if (v.seqNum == current_sequence)
 				glColor4f(1, 1, 1, 0.6);
 			else
 				glColor4f(1, 1, 0, 0.3);
@@ -140,12 +214,12 @@ namespace
 			glDisable(GL_DEPTH_TEST);
 
 			glBegin(GL_LINE_STRIP);
-			for (PosNum i = v.second.begin; i != v.second.end; ++i) glVertex(apply(r, seq[i], j));
+			for (PosNum i = v.begin; i != v.end; ++i) glVertex(apply(r, seq[i], j));
 			glEnd();
 
 			glPointSize(20);
 			glBegin(GL_POINTS);
-			for (PosNum i = v.second.begin; i != v.second.end; ++i)
+			for (PosNum i = v.begin; i != v.end; ++i)
 				if (i == 0 || i == seq.size() - 1)
 					glVertex(apply(r, seq[i], j));
 			glEnd();
@@ -153,8 +227,8 @@ namespace
 			if (edit_mode)
 			{
 				#ifdef USE_FTGL
-					if (!style.font.Error() && v.second.seqNum == current_sequence)
-						for (PosNum i = v.second.begin + 1; i != v.second.end; ++i)
+					if (!style.font.Error() && v.seqNum == current_sequence)
+						for (PosNum i = v.begin + 1; i != v.end; ++i)
 							renderText(
 								style.font,
 								world2screen(camera, apply(r, seq[i], j)),
@@ -162,7 +236,7 @@ namespace
 				#else
 					glPointSize(10);
 					glBegin(GL_POINTS);
-					for (PosNum i = v.second.begin; i != v.second.end; ++i)
+					for (PosNum i = v.begin; i != v.end; ++i)
 						if (i != 0 && i != seq.size() - 1)
 							glVertex(apply(r, seq[i], j));
 					glEnd();
@@ -6,35 +6,28 @@ namespace GrappleMap {
 
 namespace
 {
-	Viable viableFront(
-		Graph const & graph, SeqNum const seq, PlayerJoint const j,
-		Camera const & camera, PositionReorientation const & r)
+	Viable viableFront(ViableTrack const & track, PlayerJoint const j, Camera const & camera)
 	{
-		auto const xyz = apply(r, graph[seq].positions.front(), j);
+		auto const xyz = track.positions.front()[j];
 		auto const xy = world2xy(camera, xyz);
-		return Viable{seq, r, 0, 0, 1, xyz, xyz, xy, xy};
+		return Viable{track.seqNum, track.reorientation, 0, 0, 1, xyz, xyz, xy, xy};
 	}
 
-	Viable viableBack(
-		Graph const & graph, SeqNum const seq, PlayerJoint const j,
-		Camera const & camera, PositionReorientation const & r)
+	Viable viableBack(ViableTrack const & track, PlayerJoint const j, Camera const & camera)
 	{
-		auto const & sequence = graph[seq];
-		auto const xyz = apply(r, sequence.positions.back(), j);
+		PosNum const n = track.positions.size();
+		auto const xyz = track.positions.back()[j];
 		auto const xy = world2xy(camera, xyz);
-		return Viable{seq, r, 0, end(sequence) - 1, end(sequence), xyz, xyz, xy, xy};
+		return Viable{track.seqNum, track.reorientation, 0, PosNum(n - 1), n, xyz, xyz, xy, xy};
 	}
 
-	void extend_from(int depth, Graph const &, ReorientedNode, PlayerJoint, Camera const &, ViablesForJoint &);
-
-	void extend_forward(int const depth, Graph const & graph,
+	bool extend_forward(ViableTrack const & track,
 		Viable & via, PlayerJoint const j, Camera const & camera, ViablesForJoint & vfj)
+			// returns whether the end of the track was reached
 	{
-		auto const & sequence = graph[via.seqNum];
-
-		for (; via.end != sequence.positions.size(); ++via.end)
+		for (; via.end != track.positions.size(); ++via.end)
 		{
-			V3 const v = apply(via.reorientation, sequence.positions[via.end], j);
+			V3 const v = track.positions[via.end][j];
 			V2 const xy = world2xy(camera, v);
 
 			if (distanceSquared(v, via.endV3) < 0.003) break;
@@ -55,27 +48,18 @@ namespace
 			via.endxy = xy;
 		}
 
-		if (via.end == sequence.positions.size())
-		{
-			auto const & to = graph.to(via.seqNum);
-			ReorientedNode const n{to.node, compose(to.reorientation, via.reorientation)};
-
-			assert(basicallySame(graph[n], via.reorientation(sequence.positions.back())));
-
-			extend_from(depth + 1, graph, n, j, camera, vfj);
-		}
+		return via.end == track.positions.size();
 	}
 
-	void extend_backward(int const depth, Graph const & graph,
+	bool extend_backward(ViableTrack const & track,
 		Viable & via, PlayerJoint const j, Camera const & camera, ViablesForJoint & vfj)
+			// returns whether the start of the track was reached
 	{
-		auto & sequence = graph[via.seqNum];
-
 		int pos = via.begin;
 		--pos;
 		for (; pos != -1; --pos)
 		{
-			V3 const v = apply(via.reorientation, sequence.positions[pos], j);
+			V3 const v = track.positions[pos][j];
 			V2 const xy = world2xy(camera, v);
 
 			if (distanceSquared(v, via.beginV3) < 0.003) break;
@@ -98,88 +82,150 @@ namespace
 
 		via.begin = pos + 1;
 
-		if (via.begin == 0)
-		{
-			auto const & from = graph.from(via.seqNum);
-			ReorientedNode const n{from.node, compose(from.reorientation, via.reorientation)};
-
-			assert(basicallySame(graph[n], via.reorientation(sequence.positions.front())));
+		return via.begin == 0;
+	}
 
-			extend_from(depth+1, graph, n, j, camera, vfj);
-		}
+	bool has_viable(ViablesForJoint const & vfj, SeqNum const s)
+	{
+		foreach (v : vfj.viables) if (v.seqNum == s) return true;
+		return false;
 	}
 
-	void extend_from(int const depth, Graph const & graph, ReorientedNode const rn,
+	void extend_from(vector<ViableTrack> const & tracks,
 		PlayerJoint const j, Camera const & camera, ViablesForJoint & vfj)
 	{
-		if (depth >= 2) return;
+		foreach (t : tracks)
+			if (!has_viable(vfj, t.seqNum))
+			{
+				if (t.forward)
+				{
+					vfj.viables.push_back(viableFront(t, j, camera));
+					extend_forward(t, vfj.viables.back(), j, camera, vfj);
+				}
+				else
+				{
+					vfj.viables.push_back(viableBack(t, j, camera));
+					extend_backward(t, vfj.viables.back(), j, camera, vfj);
+				}
+			}
+	}
+}
 
-		foreach(seqNum : seqnums(graph))
+ViableTracks viableTracks(Graph const & graph, SeqNum const seq, PositionReorientation const reo)
+{
+	auto track = [&](SeqNum const s, PositionReorientation const r, bool const forward)
+		{
+			ViableTrack t{s, r, {}, forward};
+			foreach (p : graph[s].positions) t.positions.push_back(r(p));
+			return t;
+		};
+
+	auto tracks_at = [&](ReorientedNode const & rn)
 		{
-			#ifndef NDEBUG
-				auto const & s = graph[seqNum];
-				auto const here = graph[rn];
-			#endif
+			vector<SeqNum> seqs = graph.out(rn.node);
+			append(seqs, graph.in(rn.node));
+			std::sort(seqs.begin(), seqs.end());
+			seqs.erase(std::unique(seqs.begin(), seqs.end()), seqs.end());
 
-			auto const from = graph.from(seqNum);
-			auto const to = graph.to(seqNum);
+			vector<ViableTrack> r;
 
-			if (from.node == rn.node && vfj.viables.find(seqNum) == vfj.viables.end())
+			foreach (s : seqs)
 			{
-				assert(basicallySame(graph[from], s.positions.front()));
+				if (s == seq) continue;
 
-				PositionReorientation const seqReo = compose(inverse(from.reorientation), rn.reorientation);
+				auto const & from = graph.from(s);
+				auto const & to = graph.to(s);
 
-				assert(basicallySame(here, seqReo(s.positions.front())));
+				if (from.node == rn.node)
+					r.push_back(track(s, compose(inverse(from.reorientation), rn.reorientation), true));
+				else
+					r.push_back(track(s, compose(inverse(to.reorientation), rn.reorientation), false));
 
-				extend_forward(
-					depth + 1, graph,
-					vfj.viables[seqNum] = viableFront(graph, seqNum, j, camera, seqReo),
-					j, camera, vfj);
+				assert(basicallySame(graph[rn], r.back().forward
+					? r.back().positions.front()
+					: r.back().positions.back()));
 			}
-			else if (to.node == rn.node && vfj.viables.find(seqNum) == vfj.viables.end())
-			{
-				assert(basicallySame(graph[to], s.positions.back()));
 
-				PositionReorientation const seqReo = compose(inverse(to.reorientation), rn.reorientation);
+			return r;
+		};
 
-				assert(basicallySame(here, seqReo(s.positions.back())));
+	auto const & from = graph.from(seq);
+	auto const & to = graph.to(seq);
 
-				extend_backward(
-					depth + 1, graph,
-					vfj.viables[seqNum] = viableBack(graph, seqNum, j, camera, seqReo),
-					j, camera, vfj);
-			}
-		}
+	return ViableTracks
+		{ track(seq, reo, true)
+		, tracks_at(ReorientedNode{from.node, compose(from.reorientation, reo)})
+		, tracks_at(ReorientedNode{to.node, compose(to.reorientation, reo)}) };
+}
+
+void determineViables
+	( ViableTracks const & tracks, PosNum const from, PlayerJoint const j
+	, bool const edit_mode, Camera const & camera, ViablesForJoint & r)
+{
+	r.total_dist = 0;
+	r.viables.clear();
+	r.segments.clear();
+
+	if (!edit_mode && !jointDefs[j.joint].draggable) return;
+
+	auto const & main = tracks.main;
+	auto const jp = main.positions[from][j];
+	auto const jpxy = world2xy(camera, jp);
+
+	r.viables.push_back(Viable{main.seqNum, main.reorientation, 0, from, PosNum(from + 1), jp, jp, jpxy, jpxy});
+		// extend_from appends, so r.viables.front() is re-fetched rather than held on to
+	if (extend_forward(main, r.viables.front(), j, camera, r)) extend_from(tracks.at_back, j, camera, r);
+	if (extend_backward(main, r.viables.front(), j, camera, r)) extend_from(tracks.at_front, j, camera, r);
+
+	if (r.total_dist < 0.3)
+	{
+		r.total_dist = 0;
+		r.viables.clear();
+		return;
 	}
+
+	std::sort(r.viables.begin(), r.viables.end(),
+		[](Viable const & a, Viable const & b) { return a.seqNum < b.seqNum; });
 }
 
 ViablesForJoint determineViables
 	( Graph const & graph, PositionInSequence const from, PlayerJoint const j
 	, bool const edit_mode, Camera const & camera, PositionReorientation const reo)
 {
-	ViablesForJoint r
-		{ 0
-		, std::map<SeqNum, Viable>{}
-		, std::vector<LineSegment>{} };
+	ViablesForJoint r;
+	determineViables(viableTracks(graph, from.sequence, reo), from.position, j, edit_mode, camera, r);
+	return r;
+}
 
-	if (!edit_mode && !jointDefs[j.joint].draggable) return r;
+Viables const & ViablesCache::operator()
+	( Graph const & graph, PositionInSequence const from
+	, bool const em, Camera const & cam, PositionReorientation const reo)
+{
+	bool const walk =
+		graph.stamp() != graph_stamp || !sequence || *sequence != from.sequence || !(reo == reorientation);
 
-	auto const jp = apply(reo, graph[from], j);
-	auto const jpxy = world2xy(camera, jp);
+	if (walk)
+	{
+		tracks = viableTracks(graph, from.sequence, reo);
+		graph_stamp = graph.stamp();
+		sequence = from.sequence;
+		reorientation = reo;
+	}
 
-	auto & v = r.viables[from.sequence] =
-		Viable{from.sequence, reo, 0, from.position, from.position + 1, jp, jp, jpxy, jpxy};
-	extend_forward(0, graph, v, j, camera, r);
-	extend_backward(0, graph, v, j, camera, r);
+	if (walk || from.position != position || em != edit_mode || cam.full() != camera)
+	{
+		pool.run(playerJoints.size(), [&](size_t const i)
+			{
+				PlayerJoint const j = playerJoints[i];
+				determineViables(tracks, from.position, j, em, cam, viables[j]);
+			});
 
-	if (r.total_dist < 0.3) return
-		ViablesForJoint
-			{ 0
-			, std::map<SeqNum, Viable>{}
-			, std::vector<LineSegment>{} };
+		position = from.position;
+		edit_mode = em;
+		camera = cam.full();
+	}
 
-	return r;
+	return viables;
 }
 
 }
@@ -2,7 +2,7 @@
 #define GRAPPLEMAP_VIABLES_HPP
 
 #include "positions.hpp"
-#include <map>
+#include "parallel.hpp"
 
 namespace GrappleMap
 {
@@ -22,15 +22,61 @@ namespace GrappleMap
 	struct ViablesForJoint
 	{
 		double total_dist;
-		std::map<SeqNum, Viable> viables;
+		vector<Viable> viables; // at most one per sequence, by seqnum
 		std::vector<LineSegment> segments;
 	};
 
 	using Viables = PerPlayerJoint<ViablesForJoint>;
 
+	struct ViableTrack
+	{
+		SeqNum seqNum;
+		PositionReorientation reorientation;
+		vector<Position> positions; // reoriented
+		bool forward; // entered at its front
+	};
+
+	struct ViableTracks
+		// the camera-independent part of determineViables: the reoriented
+		// sequences that viables starting in a given sequence can extend into
+	{
+		ViableTrack main;
+		vector<ViableTrack> at_front, at_back;
+			// the other sequences touching main's ends, by seqnum
+	};
+
+	ViableTracks viableTracks(Graph const &, SeqNum, PositionReorientation);
+
+	void determineViables(
+		ViableTracks const &, PosNum, PlayerJoint,
+		bool edit_mode, Camera const &, ViablesForJoint &);
+		// reuses the ViablesForJoint's storage
+
 	ViablesForJoint determineViables(
 		Graph const &, PositionInSequence, PlayerJoint,
 		bool edit_mode, Camera const &, PositionReorientation);
+
+	class ViablesCache
+		// redoes the graph walk only when the graph, sequence or reorientation
+		// changes, and the projection only when the location or camera changes
+	{
+		uint64_t graph_stamp = 0;
+		optional<SeqNum> sequence;
+		PositionReorientation reorientation;
+		ViableTracks tracks;
+
+		PosNum position = 0;
+		bool edit_mode = false;
+		M camera;
+		Viables viables;
+		ThreadPool pool;
+
+	public:
+
+		Viables const & operator()(
+			Graph const &, PositionInSequence,
+			bool edit_mode, Camera const &, PositionReorientation);
+	};
 }
 
 #endif
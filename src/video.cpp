@@ -0,0 +1,177 @@
+#include "video.hpp"
+#include "png.hpp"
+#include <iomanip>
+#include <sstream>
+
+namespace GrappleMap {
+
+namespace
+{
+	class PngFrames: public FrameSink
+	{
+		string const directory;
+		unsigned index = 0;
+
+	public:
+
+		explicit PngFrames(string const d): directory(d) {}
+
+		void write(Image const & image) override
+		{
+			std::ostringstream fn;
+			fn << directory << "/frame" << std::setw(5) << std::setfill('0') << index++ << ".png";
+			write_png(image, fn.str(), PngOptions::fast());
+		}
+	};
+
+	class Y4mFrames: public FrameSink
+	{
+		ostream & out;
+		unsigned const fps;
+		bool header_written = false;
+		string frame; // reused
+
+		// BT.601 studio range, which is what encoders assume for y4m
+
+		static uint8_t y(int r, int g, int b) { return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16; }
+		static uint8_t u(int r, int g, int b) { return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128; }
+		static uint8_t v(int r, int g, int b) { return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128; }
+
+	public:
+
+		Y4mFrames(ostream & o, unsigned const f): out(o), fps(f) {}
+
+		void write(Image const & image) override
+		{
+			unsigned const w = image.width, h = image.height;
+
+			if (w % 2 || h % 2) error("y4m frames must have even dimensions");
+
+			if (!header_written)
+			{
+				out << "YUV4MPEG2 W" << w << " H" << h << " F" << fps << ":1 Ip A1:1 C420jpeg\n";
+				header_written = true;
+			}
+
+			frame.resize(w * h * 3 / 2);
+
+			char * const ys = &frame[0];
+			char * const us = ys + w * h;
+			char * const vs = us + w * h / 4;
+
+			for (unsigned i = 0; i != w * h; ++i)
+			{
+				RGB const p = image.pixels[i];
+				ys[i] = y(p.r, p.g, p.b);
+			}
+
+			for (unsigned cy = 0; cy != h / 2; ++cy)
+			for (unsigned cx = 0; cx != w / 2; ++cx)
+			{
+				RGB const
+					a = image(cx * 2, cy * 2), b = image(cx * 2 + 1, cy * 2),
+					c = image(cx * 2, cy * 2 + 1), d = image(cx * 2 + 1, cy * 2 + 1);
+
+				int const
+					r = (a.r + b.r + c.r + d.r + 2) / 4,
+					g = (a.g + b.g + c.g + d.g + 2) / 4,
+					bl = (a.b + b.b + c.b + d.b + 2) / 4;
+
+				us[cy * (w / 2) + cx] = u(r, g, bl);
+				vs[cy * (w / 2) + cx] = v(r, g, bl);
+			}
+
+			out << "FRAME\n";
+			out.write(frame.data(), frame.size());
+			if (!out) error("could not write y4m frame");
+		}
+
+		void finish() override { out.flush(); }
+	};
+
+	class RawFrames: public FrameSink
+	{
+		ostream & out;
+
+	public:
+
+		explicit RawFrames(ostream & o): out(o) {}
+
+		void write(Image const & image) override
+		{
+			static_assert(sizeof(RGB) == 3, "RGB must be packed");
+
+			out.write(reinterpret_cast<char const *>(image.pixels.data()), image.pixels.size() * sizeof(RGB));
+			if (!out) error("could not write raw frame");
+		}
+
+		void finish() override { out.flush(); }
+	};
+}
+
+std::unique_ptr<FrameSink> png_frames(string const directory)
+{
+	return std::unique_ptr<FrameSink>(new PngFrames(directory));
+}
+
+std::unique_ptr<FrameSink> y4m_frames(ostream & out, unsigned const fps)
+{
+	return std::unique_ptr<FrameSink>(new Y4mFrames(out, fps));
+}
+
+std::unique_ptr<FrameSink> raw_frames(ostream & out)
+{
+	return std::unique_ptr<FrameSink>(new RawFrames(out));
+}
+
+std::unique_ptr<FrameSink> frame_sink(string const format, string const directory, unsigned const fps)
+{
+	if (format == "png") return png_frames(directory);
+	if (format == "y4m") return y4m_frames(cout, fps);
+	if (format == "raw") return raw_frames(cout);
+
+	throw runtime_error("unknown frame format: " + format);
+}
+
+FrameWriter::FrameWriter(std::unique_ptr<FrameSink> s, size_t const capacity)
+	: sink(move(s))
+	, queue(capacity)
+	, thread([this]
+		{
+			try
+			{
+				while (optional<Image> const image = queue.pop())
+					sink->write(*image);
+
+				sink->finish();
+			}
+			catch (...)
+			{
+				failure = std::current_exception();
+				queue.close(); // so that write() stops waiting
+			}
+		})
+{}
+
+FrameWriter::~FrameWriter()
+{
+	queue.close();
+	if (thread.joinable()) thread.join();
+}
+
+void FrameWriter::write(Image image)
+{
+	if (queue.push(move(image))) return;
+
+	finish(); // rethrows the sink's exception
+	error("frame written after finish");
+}
+
+void FrameWriter::finish()
+{
+	queue.close();
+	if (thread.joinable()) thread.join();
+	if (failure) std::rethrow_exception(failure);
+}
+
+}
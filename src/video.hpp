@@ -0,0 +1,52 @@
+#ifndef GRAPPLEMAP_VIDEO_HPP
+#define GRAPPLEMAP_VIDEO_HPP
+
+#include "image.hpp"
+#include "parallel.hpp"
+#include <memory>
+
+namespace GrappleMap {
+
+class FrameSink
+	// Where the frames of a video go, one at a time and in order.
+{
+public:
+
+	virtual void write(Image const &) = 0;
+	virtual void finish() {} // after the last frame
+	virtual ~FrameSink() {}
+};
+
+std::unique_ptr<FrameSink> png_frames(string directory); // frame00000.png etc
+std::unique_ptr<FrameSink> y4m_frames(ostream &, unsigned fps); // YUV4MPEG2, 4:2:0
+std::unique_ptr<FrameSink> raw_frames(ostream &); // packed rgb24, nothing else
+
+std::unique_ptr<FrameSink> frame_sink(string format, string directory, unsigned fps);
+	// "png" writes into directory; "y4m" and "raw" write to stdout
+
+class FrameWriter
+	// Feeds a sink on a thread of its own, so that rendering the next frames
+	// overlaps with encoding and writing the previous ones.
+{
+	std::unique_ptr<FrameSink> const sink;
+	BoundedQueue<Image> queue;
+	std::exception_ptr failure;
+	std::thread thread;
+
+public:
+
+	FrameWriter(std::unique_ptr<FrameSink>, size_t capacity = 8);
+	~FrameWriter(); // still writes the frames already queued
+
+	void write(Image);
+		// waits while the queue is full; throws if the sink failed
+	void finish();
+		// waits until every frame is written; throws if the sink failed
+
+	FrameWriter(FrameWriter const &) = delete;
+	FrameWriter & operator=(FrameWriter const &) = delete;
+};
+
+}
+
+#endif